@@ -6,60 +6,128 @@
 #ifndef LOCKFREE_HASHTABLE_H
 #define LOCKFREE_HASHTABLE_H
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
-#include <cmath>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#include "lockfree_helpers/table_reclaimer.h"
-#include "../lib/hazardPointer/hazardPointer.h"
-#include "lockfree_helpers/segment.h"
+#include "lockfree_helpers/bucket_directory.h"
 #include "lockfree_helpers/reverse.h"
 #include "lockfree_helpers/lfnode.h"
+#include "lockfree_helpers/node_pool.h"
+#include "lockfree_helpers/parallel.h"
+#include "lockfree_helpers/reclaim_policy.h"
+#include "lockfree_helpers/striped_counter.h"
 
 
 namespace eht {
 
-// The maximum bucket size equals to kSegmentSize^kMaxLevel, in this case the
-// maximum bucket size is 64^4. If the load factor is 0.5, the maximum number of
-// items that Hash Table contains is 64^4 * 0.5 = 2^23. You can adjust the
-// following two values according to your memory size.
+// Hash Table can be stored 2^power_of_2_ * load factor items, kLoadFactor is
+// the default load factor.
+    const float kLoadFactor = 0.5;
 
-    const size_t kMaxBucketSize = static_cast<size_t>(pow(kSegmentSize, kMaxLevel));
+// Reserve gives every thread a range of at least this many buckets.
+    const size_t kParallelReserveBuckets = 1UL << 16;
 
-// Hash Table can be stored 2^power_of_2_ * kLoadFactor items.
-    const float kLoadFactor = 0.5;
+// Number of lookups MultiGet keeps in flight.
+    const size_t kMultiGetGroupSize = 16;
+
+// Bulk load sorts keys in ranges of about this many keys, using at most
+// 2^kBulkLoadMaxRangeBits ranges.
+    const size_t kBulkLoadRangeSize = 256;
+    const size_t kBulkLoadMaxRangeBits = 12;
+
+// Bulk load prefetches items this far ahead of the node being built.
+    const std::ptrdiff_t kBulkLoadPrefetchDistance = 8;
+
+    /**
+     * A Hash with member type is_transparent accepts keys of other types
+     * than K, e.g. std::string_view for std::string keys. Such a key must
+     * hash like the equal K and compare with K by operator<.
+     */
+    template<typename Hash, typename = void>
+    struct IsTransparent : std::false_type {};
 
-    template<typename K, typename V, typename Hash = std::hash<K>>
+    template<typename Hash>
+    struct IsTransparent<Hash, std::void_t<typename Hash::is_transparent>> : std::true_type {};
+
+    // Nodes are allocated through Alloc, see node_pool.h, and reclaimed
+    // through Reclaim, see reclaim_policy.h.
+    // V may be move-only, operations that copy a value out (Get, MultiGet,
+    // Extract) then fail to compile. Visit and Find read values in place.
+    // K may be move-only as well, lookups compare keys against a KeyProbe
+    // and only the inserts taking const K & copy it.
+    template<typename K, typename V, typename Hash = std::hash<K>,
+            typename Alloc = PooledNodeAllocator, typename Reclaim = HazardPointerReclamation>
     class LockFreeHashTable {
-        static_assert(std::is_copy_constructible_v<K>, "K requires copy constructor");
-        static_assert(std::is_copy_constructible_v<V>, "V requires copy constructor");
-        friend TableReclaimer<K, V>;
+        // Lookups by a key of type Q other than K.
+        template<typename Q>
+        using EnableIfTransparent =
+                std::enable_if_t<IsTransparent<Hash>::value && !std::is_same_v<Q, K>>;
+
+        using Domain = typename Reclaim::Domain;
+        using Guard = typename Domain::Guard;
+        using Hazard = typename Domain::Hazard;
 
     public:
-        LockFreeHashTable() : power_of_2_(1), size_(0), hash_func_(Hash()) {
-            // Initialize first bucket
-            int level = 1;
-            Segment *segments = segments_;  // Point to current segment.
-            while (level++ <= kMaxLevel - 2) {
-                Segment *sub_segments = NewSegments(level);
-                segments[0].data.store(sub_segments, std::memory_order_release);
-                segments = sub_segments;
-            }
+        using ReclaimDomain = Domain;
 
-            Bucket *buckets = NewBuckets();
-            segments[0].data.store(buckets, std::memory_order_release);
+        /**
+         * The table grows once size exceeds bucket_count() * load_factor, and
+         * shrinks below a quarter of that by default, see Shrink. If
+         * expected_size is not 0, buckets for it are reserved up front.
+         */
+        explicit LockFreeHashTable(size_t expected_size = 0, float load_factor = kLoadFactor)
+                : LockFreeHashTable(std::make_shared<ReclaimDomain>(), expected_size, load_factor) {}
 
-            auto *head = new DummyNode(0);
-            buckets[0].store(head, std::memory_order_release);
+        /**
+         * Reclaim nodes within domain, which may be shared with other tables
+         * of the same Reclaim policy, see reclaim_policy.h. Every table owns a
+         * domain by default, so a scan only looks at threads using the table
+         * and nodes it retired are reclaimed when it is destroyed. Sharing one
+         * domain saves memory of many small tables used by the same threads.
+         */
+        explicit LockFreeHashTable(std::shared_ptr<ReclaimDomain> domain, size_t expected_size = 0,
+                                   float load_factor = kLoadFactor)
+                : domain_(std::move(domain)),
+                  load_factor_(load_factor),
+                  power_of_2_(1),
+                  reserved_power_(1),
+                  approximate_size_(0),
+                  shrink_load_factor_(load_factor / 4),
+                  shrinking_(false),
+                  hash_func_(Hash()) {
+            assert(domain_ != nullptr && load_factor > 0);
+            // Initialize first bucket
+            auto *head = Alloc::template New<DummyNode>(0);
+            directory_.GetOrCreateBucket(0).store(head, std::memory_order_release);
             head_ = head;
+            if (expected_size > 0) Reserve(expected_size);
         }
 
+        /**
+         * Bulk load items with threads threads. Bucket size is chosen up front
+         * for items.size(), items are partitioned by the top bits of their
+         * split order key and every thread sorts a run of partitions, then
+         * builds and links their nodes and dummy nodes without any CAS.
+         * The table is visible to other threads only after construction, so
+         * everything is published at once. If a key appears more than once,
+         * the last value wins.
+         */
+        explicit LockFreeHashTable(std::vector<std::pair<K, V>> items,
+                                   size_t threads = DefaultThreads(),
+                                   float load_factor = kLoadFactor);
+
         ~LockFreeHashTable() {
             LFNode *p = head_;
             while (p != nullptr) {
                 LFNode *tmp = p;
                 p = p->next.load(std::memory_order_acquire);
-                tmp->Release();
+                ReleaseNode(tmp);
             }
         }
 
@@ -69,167 +137,996 @@ namespace eht {
         LockFreeHashTable &operator=(const LockFreeHashTable &other) = delete;
         LockFreeHashTable &operator=(LockFreeHashTable &&other) = delete;
 
-        bool Insert(const K &key, const V &value) {
-            auto *new_node = new RegularNode(key, value, hash_func_);
-            DummyNode *head = GetBucketHeadByHash(new_node->hash);
-            return InsertRegularNode(head, new_node);
+        bool Insert(const K &key, const V &value) { return InsertOrAssign(key, value); }
+
+        bool Insert(const K &key, V &&value) { return InsertOrAssign(key, std::move(value)); }
+
+        bool Insert(K &&key, const V &value) { return InsertOrAssign(std::move(key), value); }
+
+        bool Insert(K &&key, V &&value) {
+            return InsertOrAssign(std::move(key), std::move(value));
+        }
+
+        /**
+         * Insert key with value constructed in place from args, existing value
+         * is kept. Like std::map::try_emplace, args are left untouched if key
+         * is found.
+         * @return true if inserted
+         */
+        template<typename... Args>
+        bool TryEmplace(const K &key, Args &&... args) {
+            return EmplaceIfAbsent(key, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        bool TryEmplace(K &&key, Args &&... args) {
+            return EmplaceIfAbsent(std::move(key), std::forward<Args>(args)...);
+        }
+
+        // Insert key only if it does not exist, existing value is kept.
+        bool InsertIfAbsent(const K &key, const V &value) {
+            return EmplaceIfAbsent(key, value);
         }
 
-        bool Remove(const K &key) {
+        /**
+         * Replace the value of key with fn(value) atomically.
+         * fn takes const V & and returns V, it may be called more than once
+         * when racing with other writers.
+         * @return false if key not exists
+         */
+        template<typename F>
+        bool Update(const K &key, F &&fn) {
+            Guard guard(*domain_);
             HashKey hash = hash_func_(key);
-            DummyNode *head = GetBucketHeadByHash(hash);
-            RegularNode<K, V, Hash> delete_node(key, hash_func_);
-            return DeleteNode(head, &delete_node);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            KeyProbe<K> find_node(key, hash);
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            while (true) {
+                if (!SearchNode(head, find_node, &prev, &cur, prev_hp, cur_hp)) return false;
+                auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+                if (UpdateValue(cur_node, fn)) return true;
+                // cur is being deleted, search again once it is unlinked.
+                HelpDelete(cur_node);
+            }
+        }
+
+        /**
+         * Replace the value of key with fn(value) atomically, or insert init if
+         * key not exists.
+         * @return true if init is inserted
+         */
+        template<typename F>
+        bool Upsert(const K &key, const V &init, F &&fn) {
+            Guard guard(*domain_);
+            HashKey hash = hash_func_(key);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            KeyProbe<K> find_node(key, hash);
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            // The node is built only after key is found absent, see EmplaceIfAbsent.
+            while (SearchNode(head, find_node, &prev, &cur, prev_hp, cur_hp)) {
+                auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+                if (UpdateValue(cur_node, fn)) return false;
+                // cur is being deleted, search again once it is unlinked.
+                HelpDelete(cur_node);
+            }
+
+            auto *new_node = Alloc::template New<RegularNode<K, V, Hash>>(std::in_place, key, hash, init);
+            new_node->next.store(cur, std::memory_order_release);
+            if (prev->next.compare_exchange_strong(cur, new_node, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+                IncreaseSize(1);
+                return true;
+            }
+            return InsertRegularNode(head, new_node, [this, &fn](RegularNode<K, V, Hash> *cur_node,
+                                                                 RegularNode<K, V, Hash> *node) {
+                if (!UpdateValue(cur_node, fn)) return false;
+                Alloc::Delete(node);
+                return true;
+            });
         }
 
-        bool Get(const K &key, V &value) {
+        /**
+         * Replace the value of key with desired if it equals to expected,
+         * otherwise load the current value into expected.
+         * @return false if key not exists or value not equals to expected
+         */
+        bool CompareExchange(const K &key, V &expected, const V &desired) {
+            Guard guard(*domain_);
             HashKey hash = hash_func_(key);
-            DummyNode *head = GetBucketHeadByHash(hash);
-            RegularNode<K, V, Hash> find_node(key, hash_func_);
-            return FindNode(head, &find_node, value);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            KeyProbe<K> find_node(key, hash);
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            while (true) {
+                if (!SearchNode(head, find_node, &prev, &cur, prev_hp, cur_hp)) return false;
+                auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+                if (CompareExchangeValue(cur_node, expected, desired)) return true;
+                if (!cur_node->value.IsFrozen()) return false;
+                HelpDelete(cur_node);
+            }
+        }
+
+        /**
+         * Lookups (Remove, Get, Visit and Find) come in four forms: by K, by
+         * a key of other type if Hash is transparent (see IsTransparent), and
+         * both with a hash already known, e.g. computed by the caller to pick
+         * a shard. A given hash must equal to Hash()(key).
+         */
+        bool Remove(const K &key) { return RemoveKey(key, hash_func_(key)); }
+
+        bool Remove(const K &key, HashKey hash) { return RemoveKey(key, hash); }
+
+        template<typename Q, typename = EnableIfTransparent<Q>>
+        bool Remove(const Q &key) { return RemoveKey(key, hash_func_(key)); }
+
+        template<typename Q, typename = EnableIfTransparent<Q>>
+        bool Remove(const Q &key, HashKey hash) { return RemoveKey(key, hash); }
+
+        // Remove key and return its value, std::nullopt if key not exists.
+        // Other threads may still read the value, so it is copied out. The
+        // value is frozen first, an update racing with Extract is either in
+        // the value returned or applied to the key inserted again.
+        std::optional<V> Extract(const K &key) {
+            static_assert(std::is_copy_constructible_v<V>, "Extract requires copyable V");
+            Guard guard(*domain_);
+            HashKey hash = hash_func_(key);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            std::optional<V> value;
+            if (DeleteNode(head, KeyProbe<K>(key, hash), &value)) DecreaseSize(1);
+            return value;
+        }
+
+        bool Get(const K &key, V &value) { return GetKey(key, hash_func_(key), value); };
+
+        bool Get(const K &key, HashKey hash, V &value) { return GetKey(key, hash, value); }
+
+        template<typename Q, typename = EnableIfTransparent<Q>>
+        bool Get(const Q &key, V &value) { return GetKey(key, hash_func_(key), value); }
+
+        template<typename Q, typename = EnableIfTransparent<Q>>
+        bool Get(const Q &key, HashKey hash, V &value) { return GetKey(key, hash, value); }
+
+        /**
+         * Call fn(const V &) with the value of key while it is protected, so
+         * the value is read in place instead of copied out. fn must not
+         * keep the reference or call into the table. Inline values (see
+         * value_slot.h) are small and read through a copy.
+         * @return true if key exists and fn was called
+         */
+        template<typename F>
+        bool Visit(const K &key, F &&fn) { return VisitKey(key, hash_func_(key), fn); }
+
+        template<typename F>
+        bool Visit(const K &key, HashKey hash, F &&fn) { return VisitKey(key, hash, fn); }
+
+        template<typename Q, typename F, typename = EnableIfTransparent<Q>>
+        bool Visit(const Q &key, F &&fn) { return VisitKey(key, hash_func_(key), fn); }
+
+        template<typename Q, typename F, typename = EnableIfTransparent<Q>>
+        bool Visit(const Q &key, HashKey hash, F &&fn) { return VisitKey(key, hash, fn); }
+
+        /**
+         * ReadGuard keeps the value found by Find protected until it is
+         * destroyed, empty if key did not exist. Like a cursor it must stay
+         * on the thread that created it, and it should be short-lived: under
+         * epoch reclamation it holds back reclamation of the whole domain.
+         */
+        class ReadGuard {
+        public:
+            explicit operator bool() const { return found_; }
+
+            const V *get() const {
+                if (!found_) return nullptr;
+                if constexpr (ValueSlot<V>::kInline) {
+                    return &value_;
+                } else {
+                    return value_;
+                }
+            }
+
+            const V &operator*() const {
+                assert(found_);
+                return *get();
+            }
+
+            const V *operator->() const { return get(); }
+
+        private:
+            friend class LockFreeHashTable;
+
+            explicit ReadGuard(Domain &domain) : guard_(domain), found_(false) {}
+
+            Guard guard_;
+            Hazard node_hp_;   // A reclaimed node frees its value.
+            Hazard value_hp_;  // An update retires the value.
+            bool found_;
+            // Inline values are copied, others are read in place.
+            std::conditional_t<ValueSlot<V>::kInline, V, const V *> value_{};
+        };
+
+        // Find key without copying its value, see ReadGuard.
+        ReadGuard Find(const K &key) { return FindKey(key, hash_func_(key)); }
+
+        ReadGuard Find(const K &key, HashKey hash) { return FindKey(key, hash); }
+
+        template<typename Q, typename = EnableIfTransparent<Q>>
+        ReadGuard Find(const Q &key) { return FindKey(key, hash_func_(key)); }
+
+        template<typename Q, typename = EnableIfTransparent<Q>>
+        ReadGuard Find(const Q &key, HashKey hash) { return FindKey(key, hash); }
+
+        /**
+         * Look up count keys at once, found[i] tells whether keys[i] exists and
+         * values[i] holds its value if so. Lookups are processed in groups, and
+         * every stage (bucket, dummy head, first node of chain) is prefetched
+         * for the whole group before any lookup of the group waits on it.
+         * @return number of found keys
+         */
+        size_t MultiGet(const K *keys, size_t count, V *values, bool *found) {
+            Guard guard(*domain_);
+            size_t found_count = 0;
+            HashKey hashes[kMultiGetGroupSize];
+            BucketIndex indexes[kMultiGetGroupSize];
+            DummyNode *heads[kMultiGetGroupSize];
+            Hazard head_hps[kMultiGetGroupSize];
+            for (size_t begin = 0; begin < count; begin += kMultiGetGroupSize) {
+                size_t n = std::min(kMultiGetGroupSize, count - begin);
+                size_t bucket_mask = bucket_size() - 1;
+
+                // Stage 1: hash keys and prefetch their buckets. A block may be
+                // detached meanwhile, prefetching it is still harmless.
+                for (size_t i = 0; i < n; ++i) {
+                    hashes[i] = hash_func_(keys[begin + i]);
+                    indexes[i] = hashes[i] & bucket_mask;
+                    const Bucket *bucket = directory_.GetBucket(indexes[i]);
+                    if (bucket != nullptr) __builtin_prefetch(bucket);
+                }
+
+                // Stage 2: load heads of buckets and prefetch dummy nodes.
+                for (size_t i = 0; i < n; ++i) {
+                    heads[i] = GetOrInitializeBucket(indexes[i], head_hps[i]);
+                    __builtin_prefetch(heads[i]);
+                }
+
+                // Stage 3: prefetch the first node after each dummy node, dummy
+                // nodes are protected by head_hps so reading their next is safe.
+                for (size_t i = 0; i < n; ++i) {
+                    __builtin_prefetch(get_unmarked_reference(heads[i]->get_next()));
+                }
+
+                // Stage 4: search lists, most of the nodes are in cache by now.
+                for (size_t i = 0; i < n; ++i) {
+                    KeyProbe<K> find_node(keys[begin + i], hashes[i]);
+                    V &value = values[begin + i];
+                    found[begin + i] = FindNode(heads[i], find_node,
+                                                [&value](const V &found_value) { value = found_value; });
+                    found_count += found[begin + i];
+                }
+            }
+            return found_count;
+        }
+
+        /**
+         * Insert count pairs at once, an existing key is updated just like
+         * Insert. The batch is sorted into split order and grouped by bucket,
+         * then every group is spliced into the list in one forward traversal
+         * that resumes after the previously inserted node.
+         * If a key appears more than once, the last value wins.
+         * @return number of newly inserted keys
+         */
+        size_t MultiInsert(const K *keys, const V *values, size_t count);
+
+        // Sum of all stripes of size_, exact if no writer runs concurrently.
+        size_t size() const { return static_cast<size_t>(std::max<int64_t>(0, size_.Sum())); }
+
+        // Size seen by the last load factor check, it costs one load but lags
+        // behind size() by up to about bucket_count() / 16.
+        size_t approximate_size() const { return approximate_size_.load(std::memory_order_relaxed); }
+
+        /**
+         * Halve bucket size while load is below shrink load factor, then unlink
+         * the dummy nodes of buckets beyond the new bucket size and hand them
+         * and their bucket blocks to the reclaimer. Remove and Extract call it
+         * once load drops below the threshold. Only one thread shrinks at a
+         * time, others go on without waiting.
+         */
+        void Shrink();
+
+        /**
+         * Grow bucket size to hold n items and initialize all of its buckets,
+         * with threads threads for large blocks, so that the first requests
+         * do not initialize buckets lazily. The table does not shrink below
+         * the reserved bucket size afterwards.
+         */
+        void Reserve(size_t n, size_t threads = DefaultThreads());
+
+        // Factor 0 disables shrinking. It must stay well below load factor / 2,
+        // otherwise the table grows again right after shrinking.
+        void set_shrink_load_factor(float factor) {
+            assert(factor < load_factor_ / 2);
+            shrink_load_factor_.store(factor, std::memory_order_relaxed);
+        }
+
+        size_t bucket_count() const { return bucket_size(); }
+
+        // Pass to the constructor of another table to share the domain.
+        std::shared_ptr<ReclaimDomain> reclaim_domain() const { return domain_; }
+
+        /**
+         * Cursor walks the list in split order (ascending reverse_hash) and
+         * stops at every regular node that is not logically deleted. It is
+         * weakly consistent: keys inserted or removed during the scan may or
+         * may not be seen, but every key present for the whole scan is seen
+         * exactly once. A cursor holds hazard pointers or the epoch of the
+         * thread that created it and must stay on that thread. Under epoch
+         * reclamation a live cursor holds back reclamation of all threads.
+         */
+        class Cursor {
+        public:
+            Cursor(Cursor &&other) noexcept = default;
+            Cursor &operator=(Cursor &&other) noexcept = default;
+            Cursor(const Cursor &other) = delete;
+            Cursor &operator=(const Cursor &other) = delete;
+
+            bool Valid() const { return node_ != nullptr; }
+
+            const K &key() const { return AsRegular()->key; }
+
+            V value() const { return table_->ReadValue(AsRegular()); }
+
+            // Split order position of current node, Scan(position(), last)
+            // resumes the scan at current node.
+            HashKey position() const { return node_->reverse_hash; }
+
+            void Next() {
+                assert(Valid());
+                Settle(node_, true);
+            }
+
+        private:
+            friend class LockFreeHashTable;
+
+            Cursor(LockFreeHashTable *table, HashKey first, HashKey last)
+                    : table_(table), node_(nullptr), first_(first), last_(last),
+                      guard_(*table->domain_) {}
+
+            RegularNode<K, V, Hash> *AsRegular() const {
+                return static_cast<RegularNode<K, V, Hash> *>(node_);
+            }
+
+            // Position at the first live regular node in [first_, last_].
+            void Seek() {
+                BucketIndex bucket_index = Reverse(first_) & (table_->bucket_size() - 1);
+                Hazard head_hp;
+                DummyNode *head = table_->GetOrInitializeBucket(bucket_index, head_hp);
+                // A dummy probe never equals a regular node, so the search
+                // stops at the first node whose reverse_hash >= probe.
+                DummyNode probe(Reverse(first_ & ~0x1UL));
+                LFNode *prev;
+                LFNode *cur;
+                table_->SearchNode(head, &probe, &prev, &cur, aux_hp_, node_hp_);
+                aux_hp_.UnMark();
+                Settle(cur, false);
+            }
+
+            // Walk forward from node, which is protected by node_hp_, until the
+            // first live regular node within range. If skip is true, node
+            // itself is not a candidate.
+            void Settle(LFNode *node, bool skip) {
+                auto &reclaimer = table_->domain_->Local();
+                while (true) {
+                    if (node == nullptr || node->reverse_hash > last_) {
+                        node_hp_.UnMark();
+                        node_ = nullptr;
+                        return;
+                    }
+
+                    LFNode *next = node->get_next();
+                    if (!skip && !node->IsDummy() && node->reverse_hash >= first_ &&
+                        !is_marked_reference(next)) {
+                        node_ = node;
+                        return;
+                    }
+
+                    if (is_marked_reference(next)) {
+                        // node is logically deleted and its successor may be
+                        // reclaimed, search again from the bucket head.
+                        skip = Reseek(node, &node);
+                        continue;
+                    }
+
+                    aux_hp_.UnMark();
+                    aux_hp_ = Hazard(&reclaimer, next);
+                    // Make sure node is the predecessor of next, so that next
+                    // is properly marked as hazard.
+                    if (node->get_next() != next) {
+                        skip = true;
+                        continue;
+                    }
+                    std::swap(aux_hp_, node_hp_);
+                    aux_hp_.UnMark();
+                    node = next;
+                    skip = false;
+                }
+            }
+
+            // Search the first node not less than node, which is protected by
+            // node_hp_. The result is stored into *result and protected by
+            // node_hp_ instead. Return true if result equals to node.
+            bool Reseek(LFNode *node, LFNode **result) {
+                Hazard head_hp, prev_hp, cur_hp;
+                DummyNode *head = table_->GetBucketHeadByHash(node->hash, head_hp);
+                LFNode *prev;
+                bool equal = table_->SearchNode(head, node, &prev, result, prev_hp, cur_hp);
+                std::swap(cur_hp, node_hp_);
+                cur_hp.UnMark();
+                return equal;
+            }
+
+            LockFreeHashTable *table_;
+            LFNode *node_;           // Current node, protected by node_hp_.
+            HashKey first_;
+            HashKey last_;
+            Guard guard_;
+            Hazard node_hp_;
+            Hazard aux_hp_;
         };
 
-        size_t size() const { return size_.load(std::memory_order_relaxed); }
+        // Scan the whole table.
+        Cursor Begin() { return Scan(0, ~0UL); }
+
+        /**
+         * Scan nodes whose reverse_hash lies in [first, last]. Split the key
+         * space into ranges to scan in chunks, e.g. chunk i of n covers
+         * [i * (2^64 / n), (i + 1) * (2^64 / n) - 1].
+         */
+        Cursor Scan(HashKey first, HashKey last) {
+            Cursor cursor(this, first, last);
+            cursor.Seek();
+            return cursor;
+        }
+
+        // Scan the nodes of bucket bucket_index of current bucket_count().
+        // Buckets 0 .. bucket_count() - 1 together cover the whole table.
+        Cursor ScanBucket(BucketIndex bucket_index) {
+            size_t power = power_of_2_.load(std::memory_order_relaxed);
+            HashKey first = LFNode::DummyKey(bucket_index & ((1UL << power) - 1));
+            return Scan(first, first | (~0UL >> power));
+        }
 
     private:
+        // Give node memory back to Alloc according to its dynamic type.
+        static void ReleaseNode(LFNode *node) {
+            if (node->IsDummy()) {
+                Alloc::Delete(static_cast<DummyNode *>(node));
+            } else {
+                Alloc::Delete(static_cast<RegularNode<K, V, Hash> *>(node));
+            }
+        }
+
+        static void OnDeleteNode(void *ptr) { ReleaseNode(static_cast<LFNode *>(ptr)); }
+
+        static void OnDeleteValue(void *ptr) { delete static_cast<V *>(ptr); }
+
+        template<typename KeyArg, typename ValueArg>
+        bool InsertOrAssign(KeyArg &&key, ValueArg &&value) {
+            Guard guard(*domain_);
+            auto *new_node = Alloc::template New<RegularNode<K, V, Hash>>(
+                    std::forward<KeyArg>(key), std::forward<ValueArg>(value), hash_func_);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(new_node->hash, head_hp);
+            return InsertRegularNode(head, new_node, [this](RegularNode<K, V, Hash> *cur_node,
+                                                            RegularNode<K, V, Hash> *node) {
+                return UpdateRegularNode(cur_node, node);
+            });
+        }
+
+        // The node is built only after key is found absent. If another
+        // thread links a node first, insertion is retried with it.
+        template<typename KeyArg, typename... Args>
+        bool EmplaceIfAbsent(KeyArg &&key, Args &&... args) {
+            Guard guard(*domain_);
+            HashKey hash = hash_func_(key);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            if (SearchNode(head, KeyProbe<K>(key, hash), &prev, &cur, prev_hp, cur_hp)) {
+                return false;
+            }
+
+            auto *new_node = Alloc::template New<RegularNode<K, V, Hash>>(
+                    std::in_place, std::forward<KeyArg>(key), hash, std::forward<Args>(args)...);
+            new_node->next.store(cur, std::memory_order_release);
+            if (prev->next.compare_exchange_strong(cur, new_node, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+                IncreaseSize(1);
+                return true;
+            }
+            return InsertRegularNode(head, new_node, [](RegularNode<K, V, Hash> *,
+                                                        RegularNode<K, V, Hash> *node) {
+                Alloc::Delete(node);
+                return true;
+            });
+        }
+
+        // Smallest power of 2 whose bucket size holds n items.
+        size_t PowerFor(size_t n) const {
+            size_t power = 1;
+            while (power < kMaxBucketPower &&
+                   static_cast<float>(1UL << power) * load_factor_ < static_cast<float>(n)) {
+                ++power;
+            }
+            return power;
+        }
+
         size_t bucket_size() const {
-            return 1 << power_of_2_.load(std::memory_order_relaxed);
+            return 1UL << power_of_2_.load(std::memory_order_relaxed);
         }
 
+        // Dummy nodes are reclaimed by Shrink, so every head returned below is
+        // marked as hazard by head_hp. A head may still be logically deleted
+        // by a concurrent Shrink, SearchNode then goes on with its parent.
+
         // Initialize bucket recursively.
-        DummyNode *InitializeBucket(BucketIndex bucket_index);
+        DummyNode *InitializeBucket(BucketIndex bucket_index, Hazard &head_hp);
 
         // Get the head node of bucket, if bucket not exist then return nullptr or
         // return head.
-        DummyNode *GetBucketHeadByIndex(BucketIndex bucket_index);
+        DummyNode *GetBucketHeadByIndex(BucketIndex bucket_index, Hazard &head_hp);
 
-        // Get the head node of bucket, if bucket not exist then initialize it and
-        // return head.
-        DummyNode *GetBucketHeadByHash(HashKey hash) {
-            BucketIndex bucket_index = (hash & (bucket_size() - 1));
-            DummyNode *head = GetBucketHeadByIndex(bucket_index);
+        DummyNode *GetOrInitializeBucket(BucketIndex bucket_index, Hazard &head_hp) {
+            DummyNode *head = GetBucketHeadByIndex(bucket_index, head_hp);
             if (head == nullptr) {
-                head = InitializeBucket(bucket_index);
+                head = InitializeBucket(bucket_index, head_hp);
             }
             return head;
         }
 
-        bool InsertRegularNode(DummyNode *head, RegularNode<K, V, Hash> *new_node);
+        // Get the head node of bucket, if bucket not exist then initialize it and
+        // return head.
+        DummyNode *GetBucketHeadByHash(HashKey hash, Hazard &head_hp) {
+            return GetOrInitializeBucket(hash & (bucket_size() - 1), head_hp);
+        }
+
+        // Lookups shared by the public overloads, Q is K or a transparent key.
+        template<typename Q>
+        bool RemoveKey(const Q &key, HashKey hash) {
+            Guard guard(*domain_);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            if (!DeleteNode(head, KeyProbe<Q>(key, hash))) return false;
+            DecreaseSize(1);
+            return true;
+        }
+
+        template<typename Q>
+        bool GetKey(const Q &key, HashKey hash, V &value) {
+            return VisitKey(key, hash, [&value](const V &found) { value = found; });
+        }
+
+        template<typename Q, typename F>
+        bool VisitKey(const Q &key, HashKey hash, F &&fn) {
+            Guard guard(*domain_);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            return FindNode(head, KeyProbe<Q>(key, hash), fn);
+        }
+
+        template<typename Q>
+        ReadGuard FindKey(const Q &key, HashKey hash) {
+            ReadGuard result(*domain_);
+            Hazard head_hp;
+            DummyNode *head = GetBucketHeadByHash(hash, head_hp);
+            LFNode *cur;
+            if (LookupNode(head, KeyProbe<Q>(key, hash), &cur, result.node_hp_)) {
+                auto *node = static_cast<RegularNode<K, V, Hash> *>(cur);
+                if constexpr (ValueSlot<V>::kInline) {
+                    result.value_ = node->value.Load();
+                } else {
+                    result.value_ = ProtectValue(node, result.value_hp_);
+                }
+                result.found_ = true;
+            } else {
+                result.node_hp_.UnMark();
+            }
+            return result;
+        }
+
+        // Load the block of bucket_index and mark it as hazard, so it is not
+        // freed by Shrink. Return nullptr if block not exists and create is false.
+        Bucket *ProtectBlock(BucketIndex bucket_index, Hazard &block_hp, bool create);
+
+        // Insert new_node into list, if its key already exists then call
+        // on_exist(existing node, new_node) and return false. on_exist takes
+        // over new_node and returns true, or returns false if the value of
+        // the existing node is frozen, insertion is then retried.
+        template<typename OnExist>
+        bool InsertRegularNode(DummyNode *head, RegularNode<K, V, Hash> *new_node,
+                               OnExist &&on_exist);
+
+        // Move value of new_node into cur_node which has the same key, then
+        // delete new_node. Return false and keep new_node if the value of
+        // cur_node is frozen.
+        bool UpdateRegularNode(RegularNode<K, V, Hash> *cur_node,
+                               RegularNode<K, V, Hash> *new_node);
+
+        // Add delta to size_ and double bucket size while load factor exceeded.
+        void IncreaseSize(size_t delta);
+
+        // Subtract delta from size_ and shrink if load is below shrink load
+        // factor.
+        void DecreaseSize(size_t delta);
+
+        /**
+         * Return true if size_ should be summed up to check load factor.
+         * A thread checks each time its stripe crosses a multiple of the
+         * interval, so all stripes together lag behind by at most 1/16 of
+         * bucket size and a single insert or remove rarely touches more than
+         * its own stripe.
+         */
+        bool SizeCheckDue(int64_t before, int64_t after, size_t power) const {
+            uint64_t interval = (1UL << power) / (size_.stripes() * 16);
+            if (interval <= 1) return true;
+            return static_cast<uint64_t>(before) / interval != static_cast<uint64_t>(after) / interval;
+        }
+
+        // Sum up size_ and publish it as approximate size.
+        size_t RefreshSize() {
+            size_t size = static_cast<size_t>(std::max<int64_t>(0, size_.Sum()));
+            approximate_size_.store(size, std::memory_order_relaxed);
+            return size;
+        }
+
+        // Detach blocks from first_block on, unlink their dummy nodes and
+        // reclaim both, see Shrink.
+        void ReleaseBlocks(size_t first_block);
+
+        // Mark the value pointer of node as hazard and return it. The node
+        // itself must be protected by caller.
+        V *ProtectValue(RegularNode<K, V, Hash> *node, Hazard &value_hp);
+
+        // Copy value of node out, the node must be protected by caller.
+        V ReadValue(RegularNode<K, V, Hash> *node);
+
+        // Return false if the value of node is frozen.
+        template<typename F>
+        bool UpdateValue(RegularNode<K, V, Hash> *node, F &fn);
+
+        // Also false if the value of node is frozen, see ValueSlot::IsFrozen.
+        bool CompareExchangeValue(RegularNode<K, V, Hash> *node, V &expected, const V &desired);
+
+        // Mark node, whose value is frozen by a deletion, as logically
+        // deleted unless the deletion did already. The node must be
+        // protected by caller.
+        void HelpDelete(RegularNode<K, V, Hash> *node) {
+            LFNode *next = node->get_next();
+            while (!is_marked_reference(next) &&
+                   !node->next.compare_exchange_weak(next, get_marked_reference(next),
+                                                     std::memory_order_release,
+                                                     std::memory_order_relaxed)) {}
+        }
+
+        // If head of bucket already exists, it is stored into *real_head and
+        // marked as hazard by head_hp.
+        bool InsertDummyNode(DummyNode *parent_head, DummyNode *new_head, DummyNode **real_head,
+                             Hazard &head_hp);
 
-        bool InsertDummyNode(DummyNode *parent_head, DummyNode *new_head, DummyNode **real_head);
+        // If value is not nullptr, it receives the value of deleted node.
+        // size_ is left to the caller, a node counts as removed once marked.
+        // Of concurrent deletions of a node, the one freezing its value
+        // returns true.
+        template<typename Probe>
+        bool DeleteNode(DummyNode *head, const Probe &delete_node,
+                        std::optional<V> *value = nullptr);
 
-        bool DeleteNode(DummyNode *head, LFNode *delete_node);
+        // If find_node exists, call fn(const V &) while its value is protected.
+        template<typename Probe, typename F>
+        bool FindNode(DummyNode *head, const Probe &find_node, F &&fn);
 
-        bool FindNode(DummyNode *head, RegularNode<K, V, Hash> *find_node, V &value);
+        /**
+         * Traverse list begin with head until encounter nullptr or the first
+         * node which is greater than or equals to the given search_node.
+         * search_node is a node, or a KeyProbe for lookups, see Compare.
+         */
+        template<typename Probe>
+        bool SearchNode(DummyNode *head, const Probe &search_node, LFNode **prev_ptr,
+                        LFNode **cur_ptr, Hazard &prev_hp,
+                        Hazard &cur_hp) {
+            return SearchNodeFrom(head, head, search_node, prev_ptr, cur_ptr, prev_hp, cur_hp);
+        }
+
+        // Same as SearchNode but begin with start, which must precede
+        // search_node in bucket of head and be protected by prev_hp. Fall back
+        // to head once start is logically deleted.
+        template<typename Probe>
+        bool SearchNodeFrom(DummyNode *head, LFNode *start, const Probe &search_node,
+                            LFNode **prev_ptr, LFNode **cur_ptr,
+                            Hazard &prev_hp, Hazard &cur_hp);
 
-        // Traverse list begin with head until encounter nullptr or the first node
-        // which is greater than or equals to the given search_node.
-        bool SearchNode(DummyNode *head, LFNode *search_node, LFNode **prev_ptr,
-                        LFNode **cur_ptr, HazardPointer &prev_hp,
-                        HazardPointer &cur_hp);
+        /**
+         * Same as SearchNode for lookups, but logically deleted nodes are
+         * skipped instead of unlinked, so readers never write to the list or
+         * retire nodes. Return whether *cur_ptr, protected by cur_hp, equals
+         * to search_node.
+         */
+        template<typename Probe>
+        bool LookupNode(DummyNode *head, const Probe &search_node, LFNode **cur_ptr,
+                        Hazard &cur_hp);
 
+        // Declared first, nodes retired by the members below are reclaimed
+        // only after their destruction.
+        std::shared_ptr<ReclaimDomain> domain_;
+        const float load_factor_;
         std::atomic<size_t> power_of_2_;   // Bucket size == 2^power_of_2_.
-        std::atomic<size_t> size_;         // Item size.
+        std::atomic<size_t> reserved_power_;  // Shrink stops here.
+        // Written by load factor checks, kept off the cache line of power_of_2_.
+        alignas(kCacheLineSize) std::atomic<size_t> approximate_size_;
+        StripedCounter size_;              // Item size, see SizeCheckDue.
+        std::atomic<float> shrink_load_factor_;
+        std::atomic<bool> shrinking_;      // Some thread is in Shrink.
         Hash hash_func_;                   // Hash function.
-        Segment segments_[kSegmentSize];   // Top level segments.
+        BucketDirectory directory_;        // Buckets.
         DummyNode *head_;                  // Head of linked list.
-        static HazardPointerList global_hp_list_;
     };
 
-    // global hazard pointer list.
-    template<typename K, typename V, typename Hash>
-    HazardPointerList LockFreeHashTable<K, V, Hash>::global_hp_list_;
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::LockFreeHashTable(std::vector<std::pair<K, V>> items,
+                                                                     size_t threads, float load_factor)
+            : LockFreeHashTable(0, load_factor) {
+        size_t n = items.size();
+        threads = std::max<size_t>(1, std::min(threads, n / 1024 + 1));
+        size_t power = PowerFor(n);
 
-    template<typename K, typename V, typename Hash>
-    DummyNode *LockFreeHashTable<K, V, Hash>::InitializeBucket(BucketIndex bucket_index) {
-        BucketIndex parent_index = GetBucketParent(bucket_index);
-        DummyNode *parent_head = GetBucketHeadByIndex(parent_index);
-        if (parent_head == nullptr) {
-            parent_head = InitializeBucket(parent_index);
-        }
-
-        int level = 1;
-        Segment *segments = segments_;  // Point to current segment.
-        while (level++ <= kMaxLevel - 2) {
-            Segment &cur_segment =
-                    segments[(bucket_index / static_cast<SegmentIndex>(pow(
-                            kSegmentSize, kMaxLevel - level + 1))) %
-                             kSegmentSize];
-            Segment *sub_segments = cur_segment.get_sub_segments();
-            if (sub_segments == nullptr) {
-                // Try allocate segments.
-                sub_segments = NewSegments(level);
-                void *expected = nullptr;
-                if (!cur_segment.data.compare_exchange_strong(
-                        expected, sub_segments, std::memory_order_release)) {
-                    delete[] sub_segments;
-                    sub_segments = static_cast<Segment *>(expected);
+        // Split order keys are partitioned into 2^range_bits ranges by their
+        // top bits, about kBulkLoadRangeSize keys per range, so that every
+        // range is sorted inside cache. Thread t handles a run of ranges.
+        size_t range_bits = 0;
+        while (range_bits < std::min(power, kBulkLoadMaxRangeBits) &&
+               ((n >> range_bits) > kBulkLoadRangeSize || (1UL << range_bits) < threads)) {
+            ++range_bits;
+        }
+        size_t ranges = 1UL << range_bits;
+        auto range_of = [range_bits](HashKey key) -> size_t {
+            return range_bits == 0 ? 0 : key >> (64 - range_bits);
+        };
+
+        // 1. Hash keys and count keys of every range.
+        struct Entry {
+            HashKey reverse_hash;
+            HashKey hash;
+            size_t index;  // Index into items.
+        };
+        std::vector<Entry> hashed(n);
+        std::vector<std::vector<size_t>> offsets(threads, std::vector<size_t>(ranges, 0));
+        ParallelFor(threads, [&](size_t t) {
+            for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+                HashKey hash = hash_func_(items[i].first);
+                hashed[i] = {LFNode::RegularKey(hash), hash, i};
+                ++offsets[t][range_of(hashed[i].reverse_hash)];
+            }
+        });
+
+        // 2. Scatter keys into their ranges.
+        std::vector<size_t> range_offsets(ranges + 1, 0);
+        size_t offset = 0;
+        for (size_t r = 0; r < ranges; ++r) {
+            range_offsets[r] = offset;
+            for (size_t t = 0; t < threads; ++t) {
+                size_t count = offsets[t][r];
+                offsets[t][r] = offset;
+                offset += count;
+            }
+        }
+        range_offsets[ranges] = offset;
+        std::vector<Entry> entries(n);
+        ParallelFor(threads, [&](size_t t) {
+            for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i) {
+                entries[offsets[t][range_of(hashed[i].reverse_hash)]++] = hashed[i];
+            }
+        });
+        hashed.clear();
+        hashed.shrink_to_fit();
+
+        // 3. Sort every range, then create its nodes in split order together
+        // with the dummy nodes of non-empty buckets, so nodes are linked in
+        // the order they are allocated. Other buckets are initialized lazily
+        // as usual. Equal keys are ordered by index, the last one is kept.
+        std::vector<LFNode *> heads(ranges, nullptr);
+        std::vector<LFNode *> tails(ranges, nullptr);
+        std::vector<size_t> counts(threads, 0);
+        HashKey dummy_mask = ~0UL << (64 - power);
+        ParallelFor(threads, [&](size_t t) {
+            for (size_t r = ranges * t / threads; r < ranges * (t + 1) / threads; ++r) {
+                auto first = entries.begin() + static_cast<std::ptrdiff_t>(range_offsets[r]);
+                auto last = entries.begin() + static_cast<std::ptrdiff_t>(range_offsets[r + 1]);
+                std::sort(first, last, [&items](const Entry &entry1, const Entry &entry2) {
+                    if (entry1.reverse_hash != entry2.reverse_hash) {
+                        return entry1.reverse_hash < entry2.reverse_hash;
+                    }
+                    const K &key1 = items[entry1.index].first;
+                    const K &key2 = items[entry2.index].first;
+                    if (key1 < key2 || key2 < key1) return key1 < key2;
+                    return entry1.index < entry2.index;
+                });
+
+                LFNode *head = nullptr;
+                LFNode *tail = nullptr;
+                auto append = [&head, &tail](LFNode *node) {
+                    if (tail == nullptr) {
+                        head = node;
+                    } else {
+                        tail->next.store(node, std::memory_order_relaxed);
+                    }
+                    tail = node;
+                };
+                HashKey last_dummy_key = 0;
+                bool has_dummy = false;
+                for (auto it = first; it != last; ++it) {
+                    if (last - it > kBulkLoadPrefetchDistance) {
+                        __builtin_prefetch(&items[(it + kBulkLoadPrefetchDistance)->index]);
+                    }
+                    auto &item = items[it->index];
+                    if (it + 1 != last && it->reverse_hash == (it + 1)->reverse_hash) {
+                        // Keys are only required to have operator<, like in Compare.
+                        const K &next_key = items[(it + 1)->index].first;
+                        if (!(item.first < next_key) && !(next_key < item.first)) {
+                            continue;  // Superseded by a later item.
+                        }
+                    }
+                    HashKey dummy_key = it->reverse_hash & dummy_mask;
+                    if (!has_dummy || dummy_key != last_dummy_key) {
+                        BucketIndex bucket_index = Reverse(dummy_key);
+                        DummyNode *dummy = bucket_index == 0 ? head_ :
+                                           Alloc::template New<DummyNode>(bucket_index);
+                        directory_.GetOrCreateBucket(bucket_index).store(dummy, std::memory_order_relaxed);
+                        append(dummy);
+                        last_dummy_key = dummy_key;
+                        has_dummy = true;
+                    }
+                    append(Alloc::template New<RegularNode<K, V, Hash>>(
+                            std::move(item.first), std::move(item.second), it->hash));
+                    ++counts[t];
                 }
+                heads[r] = head;
+                tails[r] = tail;
             }
-            segments = sub_segments;
+        });
+
+        // 4. Concatenate ranges behind bucket 0.
+        LFNode *tail = head_;
+        for (size_t r = 0; r < ranges; ++r) {
+            if (heads[r] == nullptr) continue;
+            if (heads[r] != head_) tail->next.store(heads[r], std::memory_order_relaxed);
+            tail = tails[r];
         }
+        tail->next.store(nullptr, std::memory_order_relaxed);
+        size_t size = 0;
+        for (size_t count: counts) {
+            size += count;
+        }
+        size_.Add(static_cast<int64_t>(size));
+        RefreshSize();
+        power_of_2_.store(power, std::memory_order_release);
+    }
 
-        Segment &cur_segment = segments[(bucket_index / kSegmentSize) % kSegmentSize];
-        Bucket *buckets = cur_segment.get_sub_buckets();
-        if (buckets == nullptr) {
-            // Try to allocate buckets.
-            void *expected = nullptr;
-            buckets = NewBuckets();
-            if (!cur_segment.data.compare_exchange_strong(expected, buckets,
-                                                          std::memory_order_release)) {
-                delete[] buckets;
-                buckets = static_cast<Bucket *>(expected);
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    DummyNode *LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::InitializeBucket(BucketIndex bucket_index,
+                                                                               Hazard &head_hp) {
+        BucketIndex parent_index = GetBucketParent(bucket_index);
+        Hazard parent_hp;
+        DummyNode *parent_head = GetOrInitializeBucket(parent_index, parent_hp);
+
+        auto &reclaimer = domain_->Local();
+        Hazard block_hp;
+        Bucket *bucket = ProtectBlock(bucket_index, block_hp, true);
+        DummyNode *head = bucket->load(std::memory_order_acquire);
+        if (head != nullptr) {
+            head_hp.UnMark();
+            head_hp = Hazard(&reclaimer, head);
+            size_t block = BucketDirectory::BlockOf(bucket_index);
+            if (directory_.LoadBlock(block) == bucket - BucketDirectory::BucketOffset(bucket_index)) {
+                return head;
             }
         }
 
-        Bucket &bucket = buckets[bucket_index % kSegmentSize];
-        DummyNode *head = bucket.load(std::memory_order_consume);
-        if (head == nullptr) {
-            // Try to allocate dummy head.
-            head = new DummyNode(bucket_index);
-            DummyNode *real_head;  // If insert failed, real_head is the head of bucket.
-            if (InsertDummyNode(parent_head, head, &real_head)) {
-                // Dummy head must be inserted into the list before storing into bucket.
-                bucket.store(head, std::memory_order_release);
-            } else {
-                delete head;
-                head = real_head;
+        // Try to allocate dummy head.
+        head = Alloc::template New<DummyNode>(bucket_index);
+        head_hp.UnMark();
+        head_hp = Hazard(&reclaimer, head);
+        DummyNode *real_head;  // If insert failed, real_head is the head of bucket.
+        if (InsertDummyNode(parent_head, head, &real_head, head_hp)) {
+            // Dummy head must be inserted into the list before storing into bucket.
+            // If the block is detached meanwhile, head stays in the list without
+            // a bucket and is found by the next InitializeBucket.
+            bucket->store(head, std::memory_order_release);
+        } else {
+            // The dummy head is already in the list, but the thread that inserted
+            // it has not stored it yet, or stored it into a detached block.
+            // Store it too so that later lookups take the fast path, unless it
+            // may belong to a block detached by a Shrink: that Shrink is either
+            // still running or has marked it, as this block was loaded after
+            // the detach. Reclaiming a dummy node whose block is attached
+            // would break GetBucketHeadByIndex.
+            Alloc::Delete(head);
+            head = real_head;
+            size_t block = BucketDirectory::BlockOf(bucket_index);
+            if (!shrinking_.load(std::memory_order_acquire) &&
+                !is_marked_reference(head->next.load(std::memory_order_acquire)) &&
+                directory_.LoadBlock(block) == bucket - BucketDirectory::BucketOffset(bucket_index)) {
+                DummyNode *expected = nullptr;
+                bucket->compare_exchange_strong(expected, head, std::memory_order_release,
+                                                std::memory_order_relaxed);
             }
         }
         return head;
     }
 
-    template<typename K, typename V, typename Hash>
-    DummyNode *LockFreeHashTable<K, V, Hash>::GetBucketHeadByIndex(BucketIndex bucket_index) {
-        int level = 1;
-        const Segment *segments = segments_;
-        while (level++ <= kMaxLevel - 2) {
-            segments =
-                    segments[(bucket_index / static_cast<SegmentIndex>(pow(
-                            kSegmentSize, kMaxLevel - level + 1))) %
-                             kSegmentSize]
-                            .get_sub_segments();
-            if (nullptr == segments) return nullptr;
-        }
-
-        Bucket *buckets =
-                segments[(bucket_index / kSegmentSize) % kSegmentSize].get_sub_buckets();
-        if (buckets == nullptr) return nullptr;
-
-        Bucket &bucket = buckets[bucket_index % kSegmentSize];
-        return bucket.load(std::memory_order_consume);
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    Bucket *LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::ProtectBlock(BucketIndex bucket_index,
+                                                                        Hazard &block_hp,
+                                                                        bool create) {
+        auto &reclaimer = domain_->Local();
+        size_t block = BucketDirectory::BlockOf(bucket_index);
+        Bucket *buckets = directory_.LoadBlock(block);
+        while (true) {
+            if (buckets == nullptr) {
+                if (!create) return nullptr;
+                buckets = directory_.GetOrCreateBlock(block);
+            }
+            block_hp.UnMark();
+            block_hp = Hazard(&reclaimer, buckets);
+            // Make sure block is not detached before it is marked as hazard.
+            Bucket *again = directory_.LoadBlock(block);
+            if (again == buckets) return &buckets[BucketDirectory::BucketOffset(bucket_index)];
+            buckets = again;
+        }
     }
 
-    template<typename K, typename V, typename Hash>
-    bool LockFreeHashTable<K, V, Hash>::InsertDummyNode(DummyNode *parent_head, DummyNode *new_head,
-                                                        DummyNode **real_head) {
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    DummyNode *LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::GetBucketHeadByIndex(BucketIndex bucket_index,
+                                                                                   Hazard &head_hp) {
+        Hazard block_hp;
+        Bucket *bucket = ProtectBlock(bucket_index, block_hp, false);
+        if (bucket == nullptr) return nullptr;
+        DummyNode *head = bucket->load(std::memory_order_acquire);
+        if (head == nullptr) return nullptr;
+
+        auto &reclaimer = domain_->Local();
+        head_hp.UnMark();
+        head_hp = Hazard(&reclaimer, head);
+        // Shrink reclaims a dummy node only after its block is detached, so
+        // head is safe if its block is still in directory now.
+        size_t block = BucketDirectory::BlockOf(bucket_index);
+        if (directory_.LoadBlock(block) != bucket - BucketDirectory::BucketOffset(bucket_index)) {
+            head_hp.UnMark();
+            return nullptr;
+        }
+        return head;
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::InsertDummyNode(DummyNode *parent_head, DummyNode *new_head,
+                                                        DummyNode **real_head,
+                                                        Hazard &head_hp) {
         LFNode *prev, *cur;
-        HazardPointer prev_hp, cur_hp;
+        Hazard prev_hp, cur_hp;
 
        do {
             if (SearchNode(parent_head, new_head, &prev, &cur, prev_hp, cur_hp)) {
                 // The head of bucket already insert into list.
-                *real_head = dynamic_cast<DummyNode *>(cur);
+                *real_head = static_cast<DummyNode *>(cur);
+                head_hp = std::move(cur_hp);
                 return false;
             }
             new_head->next.store(cur, std::memory_order_release);
@@ -238,61 +1135,406 @@ namespace eht {
         return true;
     }
 
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    void LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::Shrink() {
+        Guard guard(*domain_);
+        // One thread shrinks at a time, others go on without waiting.
+        if (shrinking_.load(std::memory_order_relaxed) ||
+            shrinking_.exchange(true, std::memory_order_acquire)) {
+            return;
+        }
+
+        float factor = shrink_load_factor_.load(std::memory_order_relaxed);
+        size_t size = RefreshSize();
+        size_t power = power_of_2_.load(std::memory_order_relaxed);
+        size_t new_power = power;
+        size_t min_power = reserved_power_.load(std::memory_order_relaxed);
+        while (new_power > min_power &&
+               static_cast<float>(1UL << new_power) * factor > static_cast<float>(size)) {
+            --new_power;
+        }
+        // Fail if the table grows meanwhile, then nothing is released.
+        if (new_power < power &&
+            power_of_2_.compare_exchange_strong(power, new_power, std::memory_order_release)) {
+            ReleaseBlocks(new_power);
+        }
+        shrinking_.store(false, std::memory_order_release);
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    void LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::Reserve(size_t n, size_t threads) {
+        size_t power = PowerFor(n);
+        size_t reserved = reserved_power_.load(std::memory_order_relaxed);
+        while (reserved < power &&
+               !reserved_power_.compare_exchange_weak(reserved, power, std::memory_order_relaxed)) {}
+        size_t current = power_of_2_.load(std::memory_order_relaxed);
+        while (current < power &&
+               !power_of_2_.compare_exchange_weak(current, power, std::memory_order_release)) {}
+
+        // Dummy keys are split into 2^range_bits ranges by their top bits.
+        // The first bucket of every range is initialized up front, then every
+        // thread fills one range in split order, so each dummy node is
+        // inserted right after the previous one.
+        size_t range_bits = 0;
+        while (range_bits < power && (2UL << range_bits) <= threads &&
+               (1UL << (power - range_bits - 1)) >= kParallelReserveBuckets) {
+            ++range_bits;
+        }
+        for (BucketIndex bucket_index = 1; bucket_index < (1UL << range_bits); ++bucket_index) {
+            Guard guard(*domain_);
+            Hazard head_hp;
+            GetOrInitializeBucket(bucket_index, head_hp);
+        }
+
+        ParallelFor(1UL << range_bits, [&](size_t range) {
+            Guard guard(*domain_);
+            auto &reclaimer = domain_->Local();
+            HashKey range_key = range_bits == 0 ? 0 : range << (64 - range_bits);
+            Hazard head_hp, prev_hp, cur_hp, block_hp;
+            DummyNode *head = GetOrInitializeBucket(Reverse(range_key), head_hp);
+            LFNode *start = head;
+            for (size_t x = 1; x < (1UL << (power - range_bits)); ++x) {
+                BucketIndex bucket_index = Reverse(range_key | (x << (64 - power)));
+                Bucket *bucket = ProtectBlock(bucket_index, block_hp, true);
+                if (bucket->load(std::memory_order_acquire) != nullptr) continue;
+
+                auto *dummy = Alloc::template New<DummyNode>(bucket_index);
+                Hazard dummy_hp(&reclaimer, dummy);
+                LFNode *prev;
+                LFNode *cur;
+                bool exists;
+                while (true) {
+                    exists = SearchNodeFrom(head, start, dummy, &prev, &cur, prev_hp, cur_hp);
+                    if (exists) break;
+                    dummy->next.store(cur, std::memory_order_release);
+                    if (prev->next.compare_exchange_weak(cur, dummy, std::memory_order_release,
+                                                         std::memory_order_relaxed)) {
+                        break;
+                    }
+                    start = prev;
+                }
+                if (exists) {
+                    // Initialized by another thread meanwhile.
+                    Alloc::Delete(dummy);
+                    start = prev;
+                    continue;
+                }
+                bucket->store(dummy, std::memory_order_release);
+                start = dummy;
+                prev_hp = std::move(dummy_hp);
+            }
+        });
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    void LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::ReleaseBlocks(size_t first_block) {
+        // Detach blocks first. Afterwards GetBucketHeadByIndex never returns
+        // their dummy nodes, threads still using them keep them as hazard.
+        std::vector<Bucket *> blocks;
+        std::vector<DummyNode *> dummies;
+        for (size_t block = first_block; block < kMaxBucketBlocks; ++block) {
+            Bucket *buckets = directory_.DetachBlock(block);
+            if (buckets == nullptr) continue;
+            blocks.push_back(buckets);
+            for (size_t i = 0; i < BucketDirectory::BlockSize(block); ++i) {
+                DummyNode *head = buckets[i].load(std::memory_order_acquire);
+                if (head != nullptr) dummies.push_back(head);
+            }
+        }
+
+        // Unlink dummy nodes in split order. Every one is taken over by its
+        // ancestor bucket below 2^first_block, which precedes it in the list,
+        // and the search of the next dummy node resumes where the last ended.
+        std::sort(dummies.begin(), dummies.end(), [](DummyNode *node1, DummyNode *node2) {
+            return node1->reverse_hash < node2->reverse_hash;
+        });
+        BucketIndex survivor_mask = (1UL << first_block) - 1;
+        Hazard head_hp, prev_hp, cur_hp;
+        DummyNode *head = nullptr;
+        LFNode *start = nullptr;
+        BucketIndex survivor_index = 0;
+        for (DummyNode *dummy: dummies) {
+            if (head == nullptr || (dummy->hash & survivor_mask) != survivor_index) {
+                survivor_index = dummy->hash & survivor_mask;
+                head = GetOrInitializeBucket(survivor_index, head_hp);
+                start = head;
+            }
+
+            // Only Shrink deletes dummy nodes, so dummy is alive until it is
+            // marked, and the search below or any other traversal unlinks and
+            // reclaims it.
+            DummyNode probe(dummy->hash);
+            LFNode *next = dummy->get_next();
+            while (!dummy->next.compare_exchange_weak(next, get_marked_reference(next),
+                                                      std::memory_order_release,
+                                                      std::memory_order_relaxed)) {}
+
+            LFNode *prev;
+            LFNode *cur;
+            SearchNodeFrom(head, start, &probe, &prev, &cur, prev_hp, cur_hp);
+            start = prev;
+        }
+
+        auto &reclaimer = domain_->Local();
+        for (Bucket *buckets: blocks) {
+            reclaimer.ReclaimLater(buckets, BucketDirectory::FreeBlock);
+        }
+        reclaimer.TryReclaim();
+    }
+
 // Insert regular node into hash table, if its key is already exists in
-// hash table then update it and return false else return true.
-    template<typename K, typename V, typename Hash>
-    bool LockFreeHashTable<K, V, Hash>::InsertRegularNode(DummyNode *head,
-                                                          RegularNode<K, V, Hash> *new_node) {
+// hash table then hand it to on_exist and return false else return true.
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename OnExist>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::InsertRegularNode(DummyNode *head,
+                                                          RegularNode<K, V, Hash> *new_node,
+                                                          OnExist &&on_exist) {
         LFNode *prev;
         LFNode *cur;
-        HazardPointer prev_hp, cur_hp;
-        auto &reclaimer = TableReclaimer<K, V>::GetInstance(global_hp_list_);
-        do {
+        Hazard prev_hp, cur_hp;
+        while (true) {
             if (SearchNode(head, new_node, &prev, &cur, prev_hp, cur_hp)) {
-                V *new_value = new_node->value.load(std::memory_order_consume);
-                V *old_value = static_cast<RegularNode<K, V, Hash> *>(cur)->value.exchange(
-                        new_value, std::memory_order_release);
-                reclaimer.ReclaimLater(old_value,
-                                       [](void *ptr) { delete static_cast<V *>(ptr); });
-                new_node->value.store(nullptr, std::memory_order_release);
-                delete new_node;
-                return false;
+                auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+                if (on_exist(cur_node, new_node)) return false;
+                // cur is being deleted, insert once it is unlinked.
+                HelpDelete(cur_node);
+                continue;
             }
             new_node->next.store(cur, std::memory_order_release);
-        } while (!prev->next.compare_exchange_weak(
-                cur, new_node, std::memory_order_release, std::memory_order_relaxed));
+            if (prev->next.compare_exchange_weak(cur, new_node, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+                break;
+            }
+        }
+
+        IncreaseSize(1);
+        return true;
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::UpdateRegularNode(
+            RegularNode<K, V, Hash> *cur_node, RegularNode<K, V, Hash> *new_node) {
+        if constexpr (ValueSlot<V>::kInline) {
+            if (!cur_node->value.Store(new_node->value.Load())) return false;
+        } else {
+            auto &reclaimer = domain_->Local();
+            V *new_value = new_node->value.ptr.load(std::memory_order_consume);
+            V *old_value = cur_node->value.ptr.load(std::memory_order_relaxed);
+            do {
+                if (ValueSlot<V>::IsFrozen(old_value)) return false;
+            } while (!cur_node->value.ptr.compare_exchange_weak(old_value, new_value,
+                                                                std::memory_order_release,
+                                                                std::memory_order_relaxed));
+            reclaimer.ReclaimLater(old_value, OnDeleteValue);
+            new_node->value.ptr.store(nullptr, std::memory_order_release);
+        }
+        Alloc::Delete(new_node);
+        return true;
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    V *LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::ProtectValue(RegularNode<K, V, Hash> *node,
+                                                           Hazard &value_hp) {
+        auto &reclaimer = domain_->Local();
+        V *value_ptr = ValueSlot<V>::Unfrozen(node->value.ptr.load(std::memory_order_acquire));
+        while (true) {
+            value_hp.UnMark();
+            value_hp = Hazard(&reclaimer, value_ptr);
+            if (!Domain::kNeedsValidation) return value_ptr;
+            // Make sure value is not replaced before it is marked as hazard.
+            V *again = ValueSlot<V>::Unfrozen(node->value.ptr.load(std::memory_order_acquire));
+            if (again == value_ptr) return value_ptr;
+            value_ptr = again;
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    V LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::ReadValue(RegularNode<K, V, Hash> *node) {
+        if constexpr (ValueSlot<V>::kInline) {
+            return node->value.Load();
+        } else {
+            Hazard value_hp;
+            return *ProtectValue(node, value_hp);
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename F>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::UpdateValue(RegularNode<K, V, Hash> *node,
+                                                                    F &fn) {
+        if constexpr (ValueSlot<V>::kInline) {
+            return node->value.Update(fn);
+        } else {
+            Hazard value_hp;
+            while (true) {
+                V *old_value = ProtectValue(node, value_hp);
+                V *new_value = new V(fn(static_cast<const V &>(*old_value)));
+                if (node->value.ptr.compare_exchange_strong(old_value, new_value,
+                                                            std::memory_order_acq_rel)) {
+                    value_hp.UnMark();
+                    auto &reclaimer = domain_->Local();
+                    reclaimer.ReclaimLater(old_value, OnDeleteValue);
+                    return true;
+                }
+                delete new_value;
+                if (ValueSlot<V>::IsFrozen(old_value)) return false;
+            }
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::CompareExchangeValue(
+            RegularNode<K, V, Hash> *node, V &expected, const V &desired) {
+        if constexpr (ValueSlot<V>::kInline) {
+            return node->value.CompareExchange(expected, desired);
+        } else {
+            Hazard value_hp;
+            while (true) {
+                V *old_value = ProtectValue(node, value_hp);
+                if (!(*old_value == expected)) {
+                    expected = *old_value;
+                    return false;
+                }
+                auto *new_value = new V(desired);
+                if (node->value.ptr.compare_exchange_strong(old_value, new_value,
+                                                            std::memory_order_acq_rel)) {
+                    value_hp.UnMark();
+                    auto &reclaimer = domain_->Local();
+                    reclaimer.ReclaimLater(old_value, OnDeleteValue);
+                    return true;
+                }
+                delete new_value;
+                if (ValueSlot<V>::IsFrozen(old_value)) return false;
+            }
+        }
+    }
 
-        size_t size = size_.fetch_add(1, std::memory_order_relaxed) + 1;
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    void LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::IncreaseSize(size_t delta) {
+        int64_t after = size_.Add(static_cast<int64_t>(delta));
         size_t power = power_of_2_.load(std::memory_order_relaxed);
-        if (static_cast<float>(1 << power) * kLoadFactor < static_cast<float>(size)) {
+        if (!SizeCheckDue(after - static_cast<int64_t>(delta), after, power)) return;
+
+        size_t size = RefreshSize();
+        while (static_cast<float>(1UL << power) * load_factor_ < static_cast<float>(size) &&
+               power < kMaxBucketPower) {
+            // On failure power is reloaded, retry until someone grew enough.
             if (power_of_2_.compare_exchange_strong(power, power + 1,
                                                     std::memory_order_release)) {
-                assert(bucket_size() <=
-                       kMaxBucketSize);  // Out of memory or you can change the kMaxLevel
-                // and kSegmentSize.
+                ++power;
             }
         }
-        return true;
     }
 
-    template<typename K, typename V, typename Hash>
-    bool LockFreeHashTable<K, V, Hash>::SearchNode(DummyNode *head, LFNode *search_node,
-                                                   LFNode **prev_ptr, LFNode **cur_ptr,
-                                                   HazardPointer &prev_hp,
-                                                   HazardPointer &cur_hp) {
-        auto &reclaimer = TableReclaimer<K, V>::GetInstance(global_hp_list_);
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    void LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::DecreaseSize(size_t delta) {
+        int64_t after = size_.Add(-static_cast<int64_t>(delta));
+        size_t power = power_of_2_.load(std::memory_order_relaxed);
+        if (power <= reserved_power_.load(std::memory_order_relaxed) ||
+            !SizeCheckDue(after + static_cast<int64_t>(delta), after, power)) return;
+
+        float factor = shrink_load_factor_.load(std::memory_order_relaxed);
+        if (static_cast<float>(RefreshSize()) < static_cast<float>(1UL << power) * factor) {
+            Shrink();
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    size_t LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::MultiInsert(const K *keys, const V *values,
+                                                                      size_t count) {
+        Guard guard(*domain_);
+        std::vector<RegularNode<K, V, Hash> *> nodes;
+        nodes.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            nodes.push_back(Alloc::template New<RegularNode<K, V, Hash>>(keys[i], values[i],
+                                                                          hash_func_));
+        }
+        // Stable, so that the last one of equal keys stays last.
+        std::stable_sort(nodes.begin(), nodes.end(),
+                         [](RegularNode<K, V, Hash> *node1, RegularNode<K, V, Hash> *node2) {
+                             return Less<K, V, Hash>(node1, node2);
+                         });
+
+        size_t inserted = 0;
+        size_t bucket_mask = bucket_size() - 1;
+        size_t i = 0;
+        while (i < nodes.size()) {
+            // In split order every bucket is a contiguous range of the batch.
+            BucketIndex bucket_index = nodes[i]->hash & bucket_mask;
+            Hazard head_hp;
+            DummyNode *head = GetOrInitializeBucket(bucket_index, head_hp);
+
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            LFNode *start = head;
+            for (; i < nodes.size() && (nodes[i]->hash & bucket_mask) == bucket_index; ++i) {
+                RegularNode<K, V, Hash> *new_node = nodes[i];
+                if (i + 1 < nodes.size() && Equals<K, V, Hash>(new_node, nodes[i + 1])) {
+                    Alloc::Delete(new_node);  // Superseded inside the batch.
+                    continue;
+                }
+
+                while (true) {
+                    if (SearchNodeFrom(head, start, new_node, &prev, &cur, prev_hp, cur_hp)) {
+                        auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+                        if (UpdateRegularNode(cur_node, new_node)) break;
+                        // cur is being deleted, insert once it is unlinked.
+                        HelpDelete(cur_node);
+                        start = prev;
+                        continue;
+                    }
+                    new_node->next.store(cur, std::memory_order_release);
+                    if (prev->next.compare_exchange_weak(cur, new_node, std::memory_order_release,
+                                                         std::memory_order_relaxed)) {
+                        ++inserted;
+                        break;
+                    }
+                    start = prev;
+                }
+                // prev is still protected by prev_hp, next node of batch is
+                // greater than new_node so the traversal resumes from there.
+                start = prev;
+            }
+        }
+
+        if (inserted > 0) IncreaseSize(inserted);
+        return inserted;
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename Probe>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::SearchNodeFrom(DummyNode *head, LFNode *start,
+                                                                       const Probe &search_node,
+                                                                       LFNode **prev_ptr, LFNode **cur_ptr,
+                                                                       Hazard &prev_hp,
+                                                                       Hazard &cur_hp) {
+        auto &reclaimer = domain_->Local();
+        Hazard head_hp;  // Protects head once it is replaced by its parent.
         try_again:
-        LFNode *prev = head;
+        LFNode *prev = start;
         LFNode *cur = prev->get_next();
+        if (is_marked_reference(cur)) {
+            if (start == head) {
+                // head is unlinked by Shrink, the bucket of its hash in the current
+                // size takes over. Its parent may be detached as well when Shrink
+                // drops more than one power.
+                head = GetOrInitializeBucket(head->hash & (bucket_size() - 1), head_hp);
+            }
+            // start is logically deleted, begin with head again.
+            start = head;
+            goto try_again;
+        }
         LFNode *next;
         while (true) {
             cur_hp.UnMark();
-            cur_hp = HazardPointer(&reclaimer, cur);
+            cur_hp = Hazard(&reclaimer, cur);
             // Make sure prev is the predecessor of cur,
             // so that cur is properly marked as hazard.
-            if (prev->get_next() != cur) goto try_again;
+            if (Domain::kNeedsValidation && prev->get_next() != cur) goto try_again;
 
             if (cur == nullptr) {
+                if (prev == head) prev_hp = std::move(head_hp);
                 *prev_ptr = prev;
                 *cur_ptr = cur;
                 return false;
@@ -305,22 +1547,23 @@ namespace eht {
                     goto try_again;
 
                 reclaimer.ReclaimLater(cur, OnDeleteNode);
-                reclaimer.ReclaimNoHazardPointer();
-                size_.fetch_sub(1, std::memory_order_relaxed);
+                reclaimer.TryReclaim();
                 cur = get_unmarked_reference(next);
             } else {
                 if (prev->get_next() != cur) goto try_again;
 
                 // Can not get copy_cur after above invocation,
                 // because prev may not be the predecessor of cur at this point.
-                if (GreaterOrEquals<K, V, Hash>(cur,search_node)) {
+                int order = Compare<K, V, Hash>(cur, search_node);
+                if (order >= 0) {
+                    if (prev == head) prev_hp = std::move(head_hp);
                     *prev_ptr = prev;
                     *cur_ptr = cur;
-                    return Equals<K, V, Hash>(cur,search_node);
+                    return order == 0;
                 }
 
                 // Swap cur_hp and prev_hp.
-                HazardPointer tmp = std::move(cur_hp);
+                Hazard tmp = std::move(cur_hp);
                 cur_hp = std::move(prev_hp);
                 prev_hp = std::move(tmp);
 
@@ -333,29 +1576,112 @@ namespace eht {
         assert(false);
     }
 
-    template<typename K, typename V, typename Hash>
-    bool LockFreeHashTable<K, V, Hash>::DeleteNode(DummyNode *head,
-                                                   LFNode *delete_node) {
-        LFNode *prev, *cur, *next;
-        HazardPointer prev_hp, cur_hp;
-        // Logically delete cur by marking cur->next.
-       do {
-            do {
-                if (!SearchNode(head, delete_node, &prev, &cur, prev_hp, cur_hp)) {
-                    return false;
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename Probe>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::LookupNode(DummyNode *head,
+                                                                   const Probe &search_node,
+                                                                   LFNode **cur_ptr, Hazard &cur_hp) {
+        auto &reclaimer = domain_->Local();
+        Hazard head_hp;  // Protects head once it is replaced by its parent.
+        Hazard prev_hp, first_hp, next_hp;
+        try_again:
+        // prev is the last live node seen, first its successor. Deleted nodes
+        // between first and cur never change their next pointers, so all of
+        // them are still linked as long as prev->next equals to first. first_hp
+        // keeps first from being reclaimed and reused for the whole run, so
+        // that check can't be fooled by ABA, and it validates each hazard
+        // pointer taken after prev.
+        LFNode *prev = head;
+        LFNode *first = prev->get_next();
+        if (is_marked_reference(first)) {
+            // head is unlinked by Shrink, the bucket of its hash in the current
+            // size takes over. Its parent may be detached as well when Shrink
+            // drops more than one power.
+            head = GetOrInitializeBucket(head->hash & (bucket_size() - 1), head_hp);
+            goto try_again;
+        }
+        first_hp.UnMark();
+        first_hp = Hazard(&reclaimer, first);
+        if (Domain::kNeedsValidation && prev->get_next() != first) goto try_again;
+        LFNode *cur = first;
+        cur_hp.UnMark();
+        cur_hp = Hazard(&reclaimer, cur);
+
+        while (true) {
+            if (cur == nullptr) {
+                *cur_ptr = cur;
+                return false;
+            }
+
+            LFNode *next = cur->get_next();
+            bool deleted = is_marked_reference(next);
+            next = get_unmarked_reference(next);
+            if (!deleted) {
+                // cur was live when its next was read.
+                int order = Compare<K, V, Hash>(cur, search_node);
+                if (order >= 0) {
+                    *cur_ptr = cur;
+                    return order == 0;
                 }
-                next = cur->get_next();
-            } while (is_marked_reference(next));
-        }  while (!cur->next.compare_exchange_weak(next, get_marked_reference(next),
-                                                   std::memory_order_release,
-                                                   std::memory_order_relaxed));
+            }
+
+            next_hp.UnMark();
+            next_hp = Hazard(&reclaimer, next);
+            if (deleted) {
+                if (Domain::kNeedsValidation && prev->get_next() != first) goto try_again;
+            } else {
+                if (Domain::kNeedsValidation && cur->get_next() != next) goto try_again;
+                // cur becomes prev, swap cur_hp and prev_hp.
+                Hazard tmp = std::move(cur_hp);
+                cur_hp = std::move(prev_hp);
+                prev_hp = std::move(tmp);
+                prev = cur;
+                first = next;
+                first_hp.UnMark();
+                first_hp = Hazard(&reclaimer, first);
+            }
+
+            // Swap next_hp and cur_hp.
+            Hazard tmp = std::move(next_hp);
+            next_hp = std::move(cur_hp);
+            cur_hp = std::move(tmp);
+            cur = next;
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename Probe>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::DeleteNode(DummyNode *head,
+                                                   const Probe &delete_node,
+                                                   std::optional<V> *value) {
+        LFNode *prev, *cur;
+        Hazard prev_hp, cur_hp;
+        // Freeze the value of cur, so no write to it succeeds any more, then
+        // logically delete cur by marking cur->next.
+        while (true) {
+            if (!SearchNode(head, delete_node, &prev, &cur, prev_hp, cur_hp)) {
+                return false;
+            }
+            auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+            bool frozen = cur_node->value.Freeze();
+            HelpDelete(cur_node);
+            if (frozen) break;
+            // Deleted by another thread, search again once cur is unlinked.
+        }
+        LFNode *next = get_unmarked_reference(cur->get_next());
+
+        // cur is logically deleted by us and still protected by cur_hp.
+        if constexpr (std::is_copy_constructible_v<V>) {
+            if (value != nullptr) {
+                *value = ReadValue(static_cast<RegularNode<K, V, Hash> *>(cur));
+            }
+        }
 
         if (prev->next.compare_exchange_strong(cur, next,
                                                std::memory_order_release)) {
-            size_.fetch_sub(1, std::memory_order_relaxed);
-            auto &reclaimer = TableReclaimer<K, V>::GetInstance(global_hp_list_);
+            auto &reclaimer = domain_->Local();
             reclaimer.ReclaimLater(cur, OnDeleteNode);
-            reclaimer.ReclaimNoHazardPointer();
+            reclaimer.TryReclaim();
         } else {
             prev_hp.UnMark();
             cur_hp.UnMark();
@@ -365,29 +1691,26 @@ namespace eht {
         return true;
     }
 
-    template<typename K, typename V, typename Hash>
-    bool LockFreeHashTable<K, V, Hash>::FindNode(DummyNode *head,
-                                                  RegularNode<K, V, Hash> *find_node,
-                                                  V &value) {
-        LFNode *prev;
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename Probe, typename F>
+    bool LockFreeHashTable<K, V, Hash, Alloc, Reclaim>::FindNode(DummyNode *head,
+                                                  const Probe &find_node,
+                                                  F &&fn) {
         LFNode *cur;
-        HazardPointer prev_hp, cur_hp;
-        bool found = SearchNode(head, find_node, &prev, &cur, prev_hp, cur_hp);
-        auto &reclaimer = TableReclaimer<K, V>::GetInstance(global_hp_list_);
+        Hazard cur_hp;
+        bool found = LookupNode(head, find_node, &cur, cur_hp);
         if (found) {
-            V *value_ptr = static_cast<RegularNode<K, V, Hash> *>(cur)->value.load(
-                    std::memory_order_consume);
-            V *temp = value_ptr;
-            while (temp != value_ptr) {
+            auto *cur_node = static_cast<RegularNode<K, V, Hash> *>(cur);
+            if constexpr (ValueSlot<V>::kInline) {
+                const V value = cur_node->value.Load();
+                fn(value);
+            } else {
                 // When find and insert concurrently value may be deleted,
                 // see InsertRegularNode, so value must be marked as hazard.
-                temp = value_ptr;
-                value_ptr = static_cast<RegularNode<K, V, Hash> *>(cur)->value.load(
-                        std::memory_order_consume);
+                Hazard value_hp;
+                const V &value = *ProtectValue(cur_node, value_hp);
+                fn(value);
             }
-
-            reclaimer.ReclaimNoHazardPointer();
-            value = *value_ptr;
         }
         return found;
     }
@@ -0,0 +1,572 @@
+//
+// Created by Chaos Zhai on 12/22/23.
+//
+#pragma once
+
+#ifndef LOCKFREE_UNROLLED_HASHTABLE_H
+#define LOCKFREE_UNROLLED_HASHTABLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <utility>
+
+#include "lockfree_helpers/bucket_directory.h"
+#include "lockfree_helpers/entry_block.h"
+#include "lockfree_helpers/lfnode.h"
+#include "lockfree_helpers/node_pool.h"
+#include "lockfree_helpers/reclaim_policy.h"
+#include "lockfree_helpers/reverse.h"
+#include "lockfree_helpers/striped_counter.h"
+
+
+namespace eht {
+
+// Default load factor of UnrolledLockFreeHashTable, a bucket then fills about
+// half a block.
+    const float kUnrolledLoadFactor = 4;
+
+    /**
+     * UnrolledLockFreeHashTable is a split-ordered list like
+     * LockFreeHashTable whose regular nodes are EntryBlocks of up to
+     * kBlockEntries items, so a lookup misses the cache about once per block
+     * instead of once per item and high load factors stay cheap.
+     *
+     * Blocks are copied on write. A change builds the blocks replacing a
+     * block, e.g. its two halves when an insert splits a full block, links
+     * the last of them to the successor of the block and then marks the
+     * next pointer of the block with the first of them. That CAS publishes
+     * the change: the old block is logically deleted and every traversal
+     * passing it goes on with its replacement, so it is unlinked and read
+     * over like any deleted node of LockFreeHashTable. A block left without
+     * items is replaced by its successor. The dummy node of a new bucket
+     * splits the block it falls into the same way. An item less than every
+     * item of the block after it is added to the block before it, whose
+     * mark CAS then expects that successor, so the item never ends up
+     * behind a dummy node linked in between meanwhile.
+     *
+     * A write copies up to kBlockEntries items, so K and V must be copy
+     * constructible and small items suit best. The table grows only, dummy
+     * nodes are never deleted.
+     */
+    template<typename K, typename V, typename Hash = std::hash<K>,
+            typename Alloc = PooledNodeAllocator, typename Reclaim = HazardPointerReclamation>
+    class UnrolledLockFreeHashTable {
+        using Block = EntryBlock<K, V>;
+        using EntryRef = typename Block::EntryRef;
+        using Domain = typename Reclaim::Domain;
+        using Guard = typename Domain::Guard;
+        using Hazard = typename Domain::Hazard;
+
+    public:
+        using ReclaimDomain = Domain;
+
+        // If expected_size is not 0, bucket size is chosen for it up front.
+        explicit UnrolledLockFreeHashTable(size_t expected_size = 0,
+                                           float load_factor = kUnrolledLoadFactor)
+                : UnrolledLockFreeHashTable(std::make_shared<ReclaimDomain>(), expected_size,
+                                            load_factor) {}
+
+        // Reclaim blocks within domain, see LockFreeHashTable.
+        explicit UnrolledLockFreeHashTable(std::shared_ptr<ReclaimDomain> domain,
+                                           size_t expected_size = 0,
+                                           float load_factor = kUnrolledLoadFactor)
+                : domain_(std::move(domain)),
+                  load_factor_(load_factor),
+                  power_of_2_(1),
+                  hash_func_(Hash()) {
+            assert(domain_ != nullptr && load_factor > 0);
+            power_of_2_.store(PowerFor(expected_size), std::memory_order_relaxed);
+            // Initialize first bucket
+            auto *head = Alloc::template New<DummyNode>(0);
+            directory_.GetOrCreateBucket(0).store(head, std::memory_order_release);
+            head_ = head;
+        }
+
+        ~UnrolledLockFreeHashTable() {
+            LFNode *p = head_;
+            while (p != nullptr) {
+                LFNode *tmp = p;
+                p = p->next.load(std::memory_order_acquire);
+                ReleaseNode(tmp);
+            }
+        }
+
+        // Disable copy and move.
+        UnrolledLockFreeHashTable(const UnrolledLockFreeHashTable &other) = delete;
+        UnrolledLockFreeHashTable(UnrolledLockFreeHashTable &&other) = delete;
+        UnrolledLockFreeHashTable &operator=(const UnrolledLockFreeHashTable &other) = delete;
+        UnrolledLockFreeHashTable &operator=(UnrolledLockFreeHashTable &&other) = delete;
+
+        // Insert key or assign value to it, return true if inserted.
+        bool Insert(const K &key, const V &value) { return InsertEntry(key, value, true); }
+
+        // Insert key only if it does not exist, existing value is kept.
+        bool InsertIfAbsent(const K &key, const V &value) {
+            return InsertEntry(key, value, false);
+        }
+
+        bool Remove(const K &key) {
+            Guard guard(*domain_);
+            HashKey hash = hash_func_(key);
+            DummyNode *head = GetBucketHeadByHash(hash);
+            KeyProbe<K> probe(key, hash);
+            EntryRef refs[kBlockEntries];
+            while (true) {
+                LFNode *prev;
+                LFNode *cur;
+                Hazard prev_hp, cur_hp;
+                SearchNode(head, probe, &prev, &cur, prev_hp, cur_hp);
+                if (cur == nullptr || cur->IsDummy()) return false;
+
+                auto *block = static_cast<Block *>(cur);
+                size_t index = block->LowerBound(probe.reverse_hash, key);
+                if (!block->Holds(index, probe.reverse_hash, key)) return false;
+                size_t n = 0;
+                for (size_t i = 0; i < block->count; ++i) {
+                    if (i != index) refs[n++] = block->Ref(i);
+                }
+                LFNode *last = nullptr;
+                LFNode *first = n == 0 ? nullptr : NewBlocks(refs, n, &last);
+                if (ReplaceBlock(head, probe, prev, block, block->get_next(), first, last)) {
+                    size_.Add(-1);
+                    return true;
+                }
+                DeleteBlocks(first, last);
+            }
+        }
+
+        bool Get(const K &key, V &value) {
+            return Visit(key, [&value](const V &found) { value = found; });
+        }
+
+        // Call fn(const V &) with the value of key while its block is
+        // protected, return true if key exists and fn was called.
+        template<typename F>
+        bool Visit(const K &key, F &&fn) {
+            Guard guard(*domain_);
+            HashKey hash = hash_func_(key);
+            DummyNode *head = GetBucketHeadByHash(hash);
+            KeyProbe<K> probe(key, hash);
+            Hazard cur_hp;
+            LFNode *cur = LookupNode(head, probe, cur_hp);
+            if (cur == nullptr || cur->IsDummy()) return false;
+
+            auto *block = static_cast<Block *>(cur);
+            size_t index = block->LowerBound(probe.reverse_hash, key);
+            if (!block->Holds(index, probe.reverse_hash, key)) return false;
+            fn(block->value(index));
+            return true;
+        }
+
+        size_t size() const { return static_cast<size_t>(std::max<int64_t>(0, size_.Sum())); }
+
+        size_t bucket_count() const { return bucket_size(); }
+
+        std::shared_ptr<ReclaimDomain> reclaim_domain() const { return domain_; }
+
+    private:
+        // Give node memory back to Alloc according to its dynamic type.
+        static void ReleaseNode(LFNode *node) {
+            if (node->IsDummy()) {
+                Alloc::Delete(static_cast<DummyNode *>(node));
+            } else {
+                Alloc::Delete(static_cast<Block *>(node));
+            }
+        }
+
+        static void OnDeleteNode(void *ptr) { ReleaseNode(static_cast<LFNode *>(ptr)); }
+
+        // Smallest power of 2 whose bucket size holds n items.
+        size_t PowerFor(size_t n) const {
+            size_t power = 1;
+            while (power < kMaxBucketPower &&
+                   static_cast<float>(1UL << power) * load_factor_ < static_cast<float>(n)) {
+                ++power;
+            }
+            return power;
+        }
+
+        size_t bucket_size() const {
+            return 1UL << power_of_2_.load(std::memory_order_relaxed);
+        }
+
+        // Dummy nodes and bucket blocks are never freed before the table, so
+        // heads need no hazard pointer.
+
+        // Initialize bucket recursively.
+        DummyNode *InitializeBucket(BucketIndex bucket_index);
+
+        DummyNode *GetOrInitializeBucket(BucketIndex bucket_index) {
+            Bucket *bucket = directory_.GetBucket(bucket_index);
+            DummyNode *head = bucket == nullptr ? nullptr : bucket->load(std::memory_order_acquire);
+            if (head == nullptr) {
+                head = InitializeBucket(bucket_index);
+            }
+            return head;
+        }
+
+        // Get the head node of bucket, if bucket not exist then initialize it and
+        // return head.
+        DummyNode *GetBucketHeadByHash(HashKey hash) {
+            return GetOrInitializeBucket(hash & (bucket_size() - 1));
+        }
+
+        // Return new_head, or the head of its bucket if inserted by another
+        // thread meanwhile.
+        DummyNode *InsertDummyNode(DummyNode *parent_head, DummyNode *new_head);
+
+        // Insert key, or assign value if assign is true. Return true if inserted.
+        bool InsertEntry(const K &key, const V &value, bool assign);
+
+        // Build a block of the n items of refs, or two linked blocks if they
+        // do not fit into one. The last block is stored into *last.
+        LFNode *NewBlocks(const EntryRef *refs, size_t n, LFNode **last) {
+            if (n <= kBlockEntries) {
+                *last = Alloc::template New<Block>(refs, n);
+                return *last;
+            }
+            size_t half = n / 2;
+            auto *low = Alloc::template New<Block>(refs, half);
+            *last = Alloc::template New<Block>(refs + half, n - half);
+            low->next.store(*last, std::memory_order_relaxed);
+            return low;
+        }
+
+        // Delete unpublished blocks first .. last built by NewBlocks.
+        void DeleteBlocks(LFNode *first, LFNode *last) {
+            while (first != nullptr) {
+                LFNode *next = first == last ? nullptr : first->next.load(std::memory_order_relaxed);
+                Alloc::Delete(static_cast<Block *>(first));
+                first = next;
+            }
+        }
+
+        /**
+         * Replace block, protected by caller, with the unpublished nodes
+         * first .. last, or delete it if first is nullptr. prev, if not
+         * nullptr, preceded block when it was found, next is the successor
+         * block must still have. Return false if block was replaced or
+         * another node was linked after it meanwhile, the new nodes are then
+         * left to caller. On success block is unlinked before return, by a
+         * search for probe unless prev still precedes it.
+         */
+        template<typename Probe>
+        bool ReplaceBlock(DummyNode *head, const Probe &probe, LFNode *prev, Block *block,
+                          LFNode *next, LFNode *first, LFNode *last);
+
+        // Add delta to size_ and double bucket size while load factor exceeded.
+        void IncreaseSize(size_t delta);
+
+        // See LockFreeHashTable::SizeCheckDue.
+        bool SizeCheckDue(int64_t before, int64_t after, size_t power) const {
+            uint64_t interval = (1UL << power) / (size_.stripes() * 16);
+            if (interval <= 1) return true;
+            return static_cast<uint64_t>(before) / interval != static_cast<uint64_t>(after) / interval;
+        }
+
+        /**
+         * Traverse list begin with head until encounter nullptr or the first
+         * node which is greater than or equals to probe, unlinking logically
+         * deleted nodes on the way, see EntryBlock::Compare.
+         */
+        template<typename Probe>
+        bool SearchNode(DummyNode *head, const Probe &probe, LFNode **prev_ptr, LFNode **cur_ptr,
+                        Hazard &prev_hp, Hazard &cur_hp);
+
+        // Same as SearchNode for lookups, but logically deleted nodes are
+        // skipped instead of unlinked, see LockFreeHashTable::LookupNode.
+        // Return the node found, protected by cur_hp.
+        LFNode *LookupNode(DummyNode *head, const KeyProbe<K> &probe, Hazard &cur_hp);
+
+        // Declared first, nodes retired by the members below are reclaimed
+        // only after their destruction.
+        std::shared_ptr<ReclaimDomain> domain_;
+        const float load_factor_;
+        std::atomic<size_t> power_of_2_;   // Bucket size == 2^power_of_2_.
+        StripedCounter size_;              // Item size, see SizeCheckDue.
+        Hash hash_func_;                   // Hash function.
+        BucketDirectory directory_;        // Buckets.
+        DummyNode *head_;                  // Head of linked list.
+    };
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    DummyNode *UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::InitializeBucket(
+            BucketIndex bucket_index) {
+        DummyNode *parent_head = GetOrInitializeBucket(GetBucketParent(bucket_index));
+        auto *new_head = Alloc::template New<DummyNode>(bucket_index);
+        DummyNode *head = InsertDummyNode(parent_head, new_head);
+        if (head != new_head) Alloc::Delete(new_head);
+        // Dummy head must be inserted into the list before storing into bucket.
+        directory_.GetOrCreateBucket(bucket_index).store(head, std::memory_order_release);
+        return head;
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    DummyNode *UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::InsertDummyNode(
+            DummyNode *parent_head, DummyNode *new_head) {
+        EntryRef refs[kBlockEntries];
+        while (true) {
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            if (SearchNode(parent_head, new_head, &prev, &cur, prev_hp, cur_hp)) {
+                // The head of bucket already insert into list.
+                return static_cast<DummyNode *>(cur);
+            }
+
+            // Items of the block of cur before new_head move into a block of
+            // their own, followed by new_head and the rest.
+            if (cur != nullptr && !cur->IsDummy()) {
+                auto *block = static_cast<Block *>(cur);
+                size_t split = block->LowerBound(new_head->reverse_hash);
+                if (split > 0) {
+                    for (size_t i = 0; i < block->count; ++i) refs[i] = block->Ref(i);
+                    auto *low = Alloc::template New<Block>(refs, split);
+                    auto *high = Alloc::template New<Block>(refs + split, block->count - split);
+                    low->next.store(new_head, std::memory_order_relaxed);
+                    new_head->next.store(high, std::memory_order_relaxed);
+                    if (ReplaceBlock(parent_head, new_head, prev, block, block->get_next(), low,
+                                     high)) {
+                        return new_head;
+                    }
+                    Alloc::Delete(low);
+                    Alloc::Delete(high);
+                    continue;
+                }
+            }
+
+            new_head->next.store(cur, std::memory_order_release);
+            if (prev->next.compare_exchange_strong(cur, new_head, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+                return new_head;
+            }
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    bool UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::InsertEntry(const K &key,
+                                                                            const V &value,
+                                                                            bool assign) {
+        Guard guard(*domain_);
+        HashKey hash = hash_func_(key);
+        DummyNode *head = GetBucketHeadByHash(hash);
+        KeyProbe<K> probe(key, hash);
+        EntryRef refs[kBlockEntries + 1];
+        while (true) {
+            LFNode *prev;
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            SearchNode(head, probe, &prev, &cur, prev_hp, cur_hp);
+
+            // Key goes into the block that sorts after it if it is not less
+            // than the first item there. Otherwise it belongs between prev
+            // and cur, where a dummy node may be linked concurrently, so it
+            // is appended to prev only while cur still follows prev.
+            Block *block = nullptr;
+            size_t index = 0;
+            if (cur != nullptr && !cur->IsDummy()) {
+                block = static_cast<Block *>(cur);
+                index = block->LowerBound(probe.reverse_hash, key);
+                if (index == 0 && !block->Holds(0, probe.reverse_hash, key)) block = nullptr;
+            }
+            LFNode *next;
+            if (block != nullptr) {
+                next = block->get_next();
+            } else if (!prev->IsDummy()) {
+                block = static_cast<Block *>(prev);
+                index = block->count;
+                next = cur;
+                prev = nullptr;
+            } else {
+                // First item after dummy node prev.
+                EntryRef ref{probe.reverse_hash, &key, &value};
+                auto *new_block = Alloc::template New<Block>(&ref, 1);
+                new_block->next.store(cur, std::memory_order_release);
+                if (prev->next.compare_exchange_strong(cur, new_block, std::memory_order_release,
+                                                       std::memory_order_relaxed)) {
+                    IncreaseSize(1);
+                    return true;
+                }
+                Alloc::Delete(new_block);
+                continue;
+            }
+
+            bool exists = block->Holds(index, probe.reverse_hash, key);
+            if (exists && !assign) return false;
+            size_t n = 0;
+            for (size_t i = 0; i < index; ++i) refs[n++] = block->Ref(i);
+            refs[n++] = {probe.reverse_hash, &key, &value};
+            for (size_t i = index + exists; i < block->count; ++i) refs[n++] = block->Ref(i);
+
+            LFNode *last;
+            LFNode *first = NewBlocks(refs, n, &last);
+            if (ReplaceBlock(head, probe, prev, block, next, first, last)) {
+                if (exists) return false;
+                IncreaseSize(1);
+                return true;
+            }
+            DeleteBlocks(first, last);
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename Probe>
+    bool UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::ReplaceBlock(DummyNode *head,
+                                                                             const Probe &probe,
+                                                                             LFNode *prev,
+                                                                             Block *block,
+                                                                             LFNode *next,
+                                                                             LFNode *first,
+                                                                             LFNode *last) {
+        if (is_marked_reference(next)) return false;
+        if (last != nullptr) last->next.store(next, std::memory_order_relaxed);
+        LFNode *forward = first != nullptr ? first : next;
+        // The mark makes block logically deleted and forward its successor.
+        if (!block->next.compare_exchange_strong(next, get_marked_reference(forward),
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+            return false;
+        }
+
+        LFNode *expected = block;
+        if (prev != nullptr && prev->next.compare_exchange_strong(expected, forward,
+                                                                  std::memory_order_release)) {
+            auto &reclaimer = domain_->Local();
+            reclaimer.ReclaimLater(block, OnDeleteNode);
+            reclaimer.TryReclaim();
+        } else {
+            LFNode *cur;
+            Hazard prev_hp, cur_hp;
+            SearchNode(head, probe, &prev, &cur, prev_hp, cur_hp);
+        }
+        return true;
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    void UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::IncreaseSize(size_t delta) {
+        int64_t after = size_.Add(static_cast<int64_t>(delta));
+        size_t power = power_of_2_.load(std::memory_order_relaxed);
+        if (!SizeCheckDue(after - static_cast<int64_t>(delta), after, power)) return;
+
+        size_t size = this->size();
+        while (static_cast<float>(1UL << power) * load_factor_ < static_cast<float>(size) &&
+               power < kMaxBucketPower) {
+            // On failure power is reloaded, retry until someone grew enough.
+            if (power_of_2_.compare_exchange_strong(power, power + 1,
+                                                    std::memory_order_release)) {
+                ++power;
+            }
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    template<typename Probe>
+    bool UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::SearchNode(DummyNode *head,
+                                                                           const Probe &probe,
+                                                                           LFNode **prev_ptr,
+                                                                           LFNode **cur_ptr,
+                                                                           Hazard &prev_hp,
+                                                                           Hazard &cur_hp) {
+        auto &reclaimer = domain_->Local();
+        try_again:
+        LFNode *prev = head;
+        LFNode *cur = prev->get_next();
+        LFNode *next;
+        while (true) {
+            cur_hp.UnMark();
+            cur_hp = Hazard(&reclaimer, cur);
+            // Make sure prev is the predecessor of cur,
+            // so that cur is properly marked as hazard.
+            if (Domain::kNeedsValidation && prev->get_next() != cur) goto try_again;
+
+            if (cur == nullptr) {
+                *prev_ptr = prev;
+                *cur_ptr = cur;
+                return false;
+            }
+
+            next = cur->get_next();
+            if (is_marked_reference(next)) {
+                if (!prev->next.compare_exchange_strong(cur, get_unmarked_reference(next)))
+                    goto try_again;
+
+                reclaimer.ReclaimLater(cur, OnDeleteNode);
+                reclaimer.TryReclaim();
+                cur = get_unmarked_reference(next);
+            } else {
+                if (prev->get_next() != cur) goto try_again;
+
+                int order = Block::Compare(cur, probe);
+                if (order >= 0) {
+                    *prev_ptr = prev;
+                    *cur_ptr = cur;
+                    return order == 0;
+                }
+
+                // Swap cur_hp and prev_hp.
+                Hazard tmp = std::move(cur_hp);
+                cur_hp = std::move(prev_hp);
+                prev_hp = std::move(tmp);
+
+                prev = cur;
+                cur = next;
+            }
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Alloc, typename Reclaim>
+    LFNode *UnrolledLockFreeHashTable<K, V, Hash, Alloc, Reclaim>::LookupNode(DummyNode *head,
+                                                                              const KeyProbe<K> &probe,
+                                                                              Hazard &cur_hp) {
+        auto &reclaimer = domain_->Local();
+        Hazard prev_hp, first_hp, next_hp;
+        try_again:
+        // prev is the last live node seen, first its successor and protected
+        // by first_hp for the whole run, see LockFreeHashTable::LookupNode.
+        LFNode *prev = head;
+        LFNode *first = prev->get_next();
+        first_hp.UnMark();
+        first_hp = Hazard(&reclaimer, first);
+        if (Domain::kNeedsValidation && prev->get_next() != first) goto try_again;
+        LFNode *cur = first;
+        cur_hp.UnMark();
+        cur_hp = Hazard(&reclaimer, cur);
+
+        while (true) {
+            if (cur == nullptr) return nullptr;
+
+            LFNode *next = cur->get_next();
+            bool deleted = is_marked_reference(next);
+            next = get_unmarked_reference(next);
+            // cur was live when its next was read.
+            if (!deleted && Block::Compare(cur, probe) >= 0) return cur;
+
+            next_hp.UnMark();
+            next_hp = Hazard(&reclaimer, next);
+            if (deleted) {
+                if (Domain::kNeedsValidation && prev->get_next() != first) goto try_again;
+            } else {
+                if (Domain::kNeedsValidation && cur->get_next() != next) goto try_again;
+                // cur becomes prev, swap cur_hp and prev_hp.
+                Hazard tmp = std::move(cur_hp);
+                cur_hp = std::move(prev_hp);
+                prev_hp = std::move(tmp);
+                prev = cur;
+                first = next;
+                first_hp.UnMark();
+                first_hp = Hazard(&reclaimer, first);
+            }
+
+            // Swap next_hp and cur_hp.
+            Hazard tmp = std::move(next_hp);
+            next_hp = std::move(cur_hp);
+            cur_hp = std::move(tmp);
+            cur = next;
+        }
+    }
+
+}  // namespace eht
+
+#endif //LOCKFREE_UNROLLED_HASHTABLE_H
@@ -0,0 +1,116 @@
+//
+// Created by Chaos Zhai on 12/16/23.
+//
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "lfnode.h"
+
+namespace eht {
+
+    typedef std::atomic<DummyNode *> Bucket;
+
+    // Bucket index must keep its MSB clear, see LFNode::DummyKey, so there are
+    // at most 2^63 buckets and 63 blocks.
+    const size_t kMaxBucketPower = 63;
+    const size_t kMaxBucketBlocks = 63;
+
+    /**
+     * BucketDirectory maps a bucket index to its bucket in O(1).
+     * Buckets live in blocks of power-of-2 size: block 0 holds buckets 0 and 1,
+     * block b (b > 0) holds buckets [2^b, 2^(b+1)). The block of an index is
+     * the position of its MSB, so the directory grows without limit and never
+     * moves a bucket once it is published. When the table shrinks, whole
+     * blocks are detached and handed to the reclaimer.
+     */
+    class BucketDirectory {
+    public:
+        BucketDirectory() {
+            for (auto &block: blocks_) block.store(nullptr, std::memory_order_relaxed);
+        }
+
+        ~BucketDirectory() {
+            for (auto &block: blocks_) std::free(block.load(std::memory_order_acquire));
+        }
+
+        // Disable copy and move.
+        BucketDirectory(const BucketDirectory &other) = delete;
+        BucketDirectory &operator=(const BucketDirectory &other) = delete;
+
+        static size_t BlockOf(BucketIndex bucket_index) {
+            //__builtin_clzl: Get number of leading zero bits.
+            return 63 - __builtin_clzl(bucket_index | 0x1);
+        }
+
+        static size_t BlockBegin(size_t block) { return (1UL << block) & ~0x1UL; }
+
+        static size_t BlockSize(size_t block) { return std::max(2UL, 1UL << block); }
+
+        static size_t BucketOffset(BucketIndex bucket_index) {
+            return bucket_index - BlockBegin(BlockOf(bucket_index));
+        }
+
+        // Deleter of detached blocks, see DetachBlock.
+        static void FreeBlock(void *buckets) { std::free(buckets); }
+
+        Bucket *LoadBlock(size_t block) const {
+            return blocks_[block].load(std::memory_order_acquire);
+        }
+
+        // Get the block, allocate it if not exist.
+        Bucket *GetOrCreateBlock(size_t block) {
+            Bucket *buckets = blocks_[block].load(std::memory_order_acquire);
+            if (buckets == nullptr) {
+                // Zeroed memory is a block of null buckets, and calloc lets the
+                // kernel hand out large blocks lazily instead of touching them.
+                auto *new_buckets = static_cast<Bucket *>(
+                        std::calloc(BlockSize(block), sizeof(Bucket)));
+                if (new_buckets == nullptr) throw std::bad_alloc();
+                if (blocks_[block].compare_exchange_strong(buckets, new_buckets,
+                                                           std::memory_order_acq_rel)) {
+                    buckets = new_buckets;
+                } else {
+                    std::free(new_buckets);
+                }
+            }
+            return buckets;
+        }
+
+        // Remove the block from directory and return it, the caller owns it
+        // and must free it with FreeBlock once no other thread reads it.
+        Bucket *DetachBlock(size_t block) {
+            return blocks_[block].exchange(nullptr, std::memory_order_acq_rel);
+        }
+
+        // Get the bucket of bucket_index, if its block not exist then return nullptr.
+        // Not safe while blocks are detached concurrently.
+        Bucket *GetBucket(BucketIndex bucket_index) const {
+            Bucket *buckets = LoadBlock(BlockOf(bucket_index));
+            if (buckets == nullptr) return nullptr;
+            return &buckets[BucketOffset(bucket_index)];
+        }
+
+        // Get the bucket of bucket_index, allocate its block if not exist.
+        // Not safe while blocks are detached concurrently.
+        Bucket &GetOrCreateBucket(BucketIndex bucket_index) {
+            return GetOrCreateBlock(BlockOf(bucket_index))[BucketOffset(bucket_index)];
+        }
+
+    private:
+        std::atomic<Bucket *> blocks_[kMaxBucketBlocks];
+    };
+
+    // When the table size is 2^i , a logical table bucket b contains items whose
+    // keys k maintain k mod 2^i = b. When the size becomes 2^i+1, the items of
+    // this bucket are split into two buckets: some remain in the bucket b, and
+    // others, for which k mod 2^(i+1) == b + 2^i.
+    inline BucketIndex GetBucketParent(BucketIndex bucket_index) {
+        //__builtin_clzl: Get number of leading zero bits.
+        // Unset the MSB(most significant bit) of bucket_index;
+        return (~(mask >> (__builtin_clzl(bucket_index))) &
+                bucket_index);
+    }
+
+}  // namespace eht
@@ -0,0 +1,115 @@
+//
+// Created by Chaos Zhai on 12/22/23.
+//
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "lfnode.h"
+#include "striped_counter.h"
+
+namespace eht {
+
+    // Items per block of UnrolledLockFreeHashTable.
+    const size_t kBlockEntries = 8;
+
+    /**
+     * EntryBlock is a list node holding 1 .. kBlockEntries items of one
+     * bucket, sorted like regular nodes: by split order key, then by key.
+     * Split order keys of items are packed together, so a lookup reads them
+     * from one or two cache lines and compares a key only on equal hash.
+     * The block itself sorts as its last item, a search for an item thus
+     * stops at the only block that may hold it. Blocks never change once
+     * linked, see UnrolledLockFreeHashTable.
+     */
+    template<typename K, typename V>
+    class alignas(kCacheLineSize) EntryBlock : public LFNode {
+    public:
+        // An item copied into a new block.
+        struct EntryRef {
+            HashKey reverse_hash;
+            const K *key;
+            const V *value;
+        };
+
+        // refs must be sorted and count in [1, kBlockEntries].
+        EntryBlock(const EntryRef *refs, size_t count_)
+                : LFNode(Reverse(refs[count_ - 1].reverse_hash), false), count(count_) {
+            for (size_t i = 0; i < count; ++i) {
+                reverse_hashes[i] = refs[i].reverse_hash;
+                new(&entries_[i]) Entry{*refs[i].key, *refs[i].value};
+            }
+        }
+
+        ~EntryBlock() {
+            for (size_t i = 0; i < count; ++i) entry(i).~Entry();
+        }
+
+        const K &key(size_t i) const { return entry(i).key; }
+
+        const V &value(size_t i) const { return entry(i).value; }
+
+        EntryRef Ref(size_t i) const { return {reverse_hashes[i], &key(i), &value(i)}; }
+
+        // Index of the first item not less than the key of reverse_hash.
+        size_t LowerBound(HashKey reverse_hash, const K &key_) const {
+            size_t i = 0;
+            while (i < count && (reverse_hashes[i] < reverse_hash ||
+                                 (reverse_hashes[i] == reverse_hash && key(i) < key_))) {
+                ++i;
+            }
+            return i;
+        }
+
+        // Index of the first item after a dummy node of reverse_hash.
+        size_t LowerBound(HashKey reverse_hash) const {
+            size_t i = 0;
+            while (i < count && reverse_hashes[i] < reverse_hash) ++i;
+            return i;
+        }
+
+        // True if item i is the key of reverse_hash, i from LowerBound.
+        bool Holds(size_t i, HashKey reverse_hash, const K &key_) const {
+            return i < count && reverse_hashes[i] == reverse_hash && !(key_ < key(i));
+        }
+
+        // Order of node, a dummy node or a block, relative to probe.
+        static int Compare(LFNode *node, const KeyProbe<K> &probe) {
+            if (node->reverse_hash != probe.reverse_hash) {
+                return node->reverse_hash < probe.reverse_hash ? -1 : 1;
+            }
+            // Regular keys are odd, so node is a block.
+            auto *block = static_cast<EntryBlock *>(node);
+            const K &last = block->key(block->count - 1);
+            if (last < probe.key) return -1;
+            return probe.key < last ? 1 : 0;
+        }
+
+        static int Compare(LFNode *node, const DummyNode *probe) {
+            if (node->reverse_hash == probe->reverse_hash) return 0;
+            return node->reverse_hash < probe->reverse_hash ? -1 : 1;
+        }
+
+        const uint32_t count;
+        HashKey reverse_hashes[kBlockEntries];
+
+    private:
+        struct Entry {
+            K key;
+            V value;
+        };
+
+        const Entry &entry(size_t i) const {
+            return *std::launder(reinterpret_cast<const Entry *>(&entries_[i]));
+        }
+
+        Entry &entry(size_t i) { return *std::launder(reinterpret_cast<Entry *>(&entries_[i])); }
+
+        struct alignas(Entry) EntryStorage {
+            unsigned char bytes[sizeof(Entry)];
+        };
+
+        EntryStorage entries_[kBlockEntries];
+    };
+
+}  // namespace eht
@@ -5,6 +5,7 @@
 #include <atomic>
 #include <utility>
 #include "reverse.h"
+#include "value_slot.h"
 
 namespace eht {
 
@@ -12,6 +13,9 @@ namespace eht {
     using BucketIndex = size_t;
     const size_t mask = 0x8000000000000000;
 
+    // LFNode has no virtual function, regular node and dummy node are told
+    // apart by the lowest bit of reverse_hash: RegularKey always sets it and
+    // DummyKey never does. Code that owns a node casts it statically.
     class LFNode {
     public:
         LFNode(HashKey hash_, bool dummy)
@@ -19,9 +23,7 @@ namespace eht {
                   reverse_hash(dummy ? DummyKey(hash) : RegularKey(hash)),
                   next(nullptr) {}
 
-        virtual void Release() = 0;
-
-        virtual ~LFNode() = default;
+        ~LFNode() = default;
 
         static HashKey RegularKey(HashKey hash) {
             return Reverse(hash | mask);
@@ -29,7 +31,7 @@ namespace eht {
 
         static HashKey DummyKey(HashKey hash) { return Reverse(hash); }
 
-        virtual bool IsDummy() const { return (reverse_hash & 0x1) == 0; }
+        bool IsDummy() const { return (reverse_hash & 0x1) == 0; }
 
         LFNode *get_next() const { return next.load(std::memory_order_acquire); }
 
@@ -42,12 +44,6 @@ namespace eht {
     class DummyNode : public LFNode {
     public:
         explicit DummyNode(BucketIndex bucket_index) : LFNode(bucket_index, true) {}
-
-        ~DummyNode() override = default;
-
-        void Release() override { delete this; }
-
-        bool IsDummy() const override { return true; }
     };
 
 
@@ -55,37 +51,51 @@ namespace eht {
     class RegularNode : public LFNode {
     public:
         RegularNode(const K &key_, const V &value_, const Hash &hash_func)
-                : LFNode(hash_func(key_), false), key(key_), value(new V(value_)) {}
+                : LFNode(hash_func(key_), false), key(key_), value(value_) {}
 
         RegularNode(const K &key_, V &&value_, const Hash &hash_func)
                 : LFNode(hash_func(key_), false),
                   key(key_),
-                  value(new V(std::move(value_))) {}
+                  value(std::move(value_)) {}
 
         RegularNode(K &&key_, const V &value_, const Hash &hash_func)
                 : LFNode(hash_func(key_), false),
                   key(std::move(key_)),
-                  value(new V(value_)) {}
+                  value(value_) {}
 
         RegularNode(K &&key_, V &&value_, const Hash &hash_func)
                 : LFNode(hash_func(key_), false),
                   key(std::move(key_)),
-                  value(new V(std::move(value_))) {}
-
-        RegularNode(const K &key_, const Hash &hash_func)
-                : LFNode(hash_func(key_), false), key(key_), value(nullptr) {}
-
-        ~RegularNode() override {
-            V *ptr = value.load(std::memory_order_consume);
-            delete ptr;  // If update a node, value of this node is nullptr.
-        }
+                  value(std::move(value_)) {}
+
+        // Construct value in place from args, hash of key is already known.
+        template<typename KeyArg, typename... Args>
+        RegularNode(std::in_place_t, KeyArg &&key_, HashKey hash_, Args &&... args)
+                : LFNode(hash_, false),
+                  key(std::forward<KeyArg>(key_)),
+                  value(std::in_place, std::forward<Args>(args)...) {}
+
+        // Node of a key whose hash is already known, used by bulk load.
+        RegularNode(K &&key_, V &&value_, HashKey hash_)
+                : LFNode(hash_, false),
+                  key(std::move(key_)),
+                  value(std::move(value_)) {}
 
-        void Release() override { delete this; }
+        const K key;
+        ValueSlot<V> value;  // Inline or heap allocated, see value_slot.h.
+    };
 
-        bool IsDummy() const override { return false; }
+    /**
+     * KeyProbe is what a lookup searches for instead of a node of its own:
+     * the split order key of a regular node with hash, and a reference to
+     * the key. Q is K or any type that compares with K by operator<.
+     */
+    template<typename Q>
+    struct KeyProbe {
+        KeyProbe(const Q &key_, HashKey hash) : reverse_hash(LFNode::RegularKey(hash)), key(key_) {}
 
-        const K key;
-        std::atomic<V *> value;
+        const HashKey reverse_hash;
+        const Q &key;
     };
 
     /*********************
@@ -109,28 +119,47 @@ namespace eht {
             return false;
         }
 
-        auto *regular_node1 = dynamic_cast<RegularNode<K, V, Hash> *>(node1);
-        auto *regular_node2 = dynamic_cast<RegularNode<K, V, Hash> *>(node2);
+        auto *regular_node1 = static_cast<RegularNode<K, V, Hash> *>(node1);
+        auto *regular_node2 = static_cast<RegularNode<K, V, Hash> *>(node2);
         return LessRN<K, V, Hash>(regular_node1, regular_node2);
     }
 
-    template<typename K, typename V, typename Hash>
-    bool GreaterOrEquals(LFNode *node1, LFNode *node2) {
-        return !(Less<K, V, Hash>(node1, node2));
-    }
-
     template<typename K, typename V, typename Hash>
     bool Equals(LFNode *node1, LFNode *node2) {
         return !Less<K, V, Hash>(node1, node2)
                 && !Less<K, V, Hash>(node2,node1);
     }
 
+    // Order of node relative to search_node, negative if node goes first and
+    // zero if they are equal, see Less.
+    template<typename K, typename V, typename Hash>
+    int Compare(LFNode *node, LFNode *search_node) {
+        if (node->reverse_hash != search_node->reverse_hash) {
+            return node->reverse_hash < search_node->reverse_hash ? -1 : 1;
+        }
+        if (node->IsDummy() || search_node->IsDummy()) return 0;
+
+        const K &key = static_cast<RegularNode<K, V, Hash> *>(node)->key;
+        const K &search_key = static_cast<RegularNode<K, V, Hash> *>(search_node)->key;
+        if (key < search_key) return -1;
+        return search_key < key ? 1 : 0;
+    }
+
+    template<typename K, typename V, typename Hash, typename Q>
+    int Compare(LFNode *node, const KeyProbe<Q> &probe) {
+        if (node->reverse_hash != probe.reverse_hash) {
+            return node->reverse_hash < probe.reverse_hash ? -1 : 1;
+        }
+        // Regular keys are odd, so node is a regular node as well.
+        const K &key = static_cast<RegularNode<K, V, Hash> *>(node)->key;
+        if (key < probe.key) return -1;
+        return probe.key < key ? 1 : 0;
+    }
+
     bool is_marked_reference(LFNode *next);
 
     LFNode *get_marked_reference(LFNode *next);
 
     LFNode *get_unmarked_reference(LFNode *next);
 
-    static void OnDeleteNode(void *ptr) { delete static_cast<LFNode *>(ptr); }
-
 }  // namespace eht
\ No newline at end of file
@@ -0,0 +1,188 @@
+//
+// Created by Chaos Zhai on 12/16/23.
+//
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace eht {
+
+    // Number of blocks carved out of one slab.
+    const size_t kSlabBlocks = 256;
+    // A thread keeps at most this many free blocks, the surplus is handed back
+    // to the shared depot in batches of kSlabBlocks.
+    const size_t kMaxLocalFreeBlocks = 2 * kSlabBlocks;
+
+    /**
+     * NodePool is a slab allocator for fixed size blocks.
+     * Every thread allocates from and frees into its own free list, so the
+     * common path touches no shared memory. Only when the local list runs dry
+     * or grows too long a whole batch is exchanged with the depot, which is
+     * shared by all threads using the same block size.
+     * Slabs are never returned to the system: nodes are freed by whatever
+     * thread reclaims them, so a slab can not be owned by a single thread.
+     * A pool thus retains the memory of its peak block count until process
+     * exit, free blocks are only reused by nodes of the same size. Slabs are
+     * not tracked, they are leaked on exit like the depot.
+     */
+    template<size_t BlockSize, size_t Align>
+    class NodePool {
+    public:
+        static void *Allocate() {
+            LocalCache &cache = local_cache_;
+            if (cache.state == kAlive || Attach(cache)) {
+                if (cache.head == nullptr) Refill(cache);
+                FreeBlock *block = cache.head;
+                cache.head = block->next;
+                --cache.count;
+                return block;
+            }
+
+            // Thread is exiting, take blocks from depot directly.
+            LocalCache tmp{nullptr, 0, kDead};
+            Refill(tmp);
+            FreeBlock *block = tmp.head;
+            tmp.head = block->next;
+            --tmp.count;
+            if (tmp.head != nullptr) PushBatch(tmp.head, tmp.count);
+            return block;
+        }
+
+        static void Deallocate(void *ptr) {
+            auto *block = static_cast<FreeBlock *>(ptr);
+            LocalCache &cache = local_cache_;
+            if (cache.state != kAlive && !Attach(cache)) {
+                // Thread is exiting, hand the block over to other threads.
+                block->next = nullptr;
+                PushBatch(block, 1);
+                return;
+            }
+
+            block->next = cache.head;
+            cache.head = block;
+            if (++cache.count > kMaxLocalFreeBlocks) {
+                // Detach the first kSlabBlocks blocks as one batch.
+                FreeBlock *batch = cache.head;
+                FreeBlock *tail = batch;
+                for (size_t i = 1; i < kSlabBlocks; ++i) tail = tail->next;
+                cache.head = tail->next;
+                cache.count -= kSlabBlocks;
+                tail->next = nullptr;
+                PushBatch(batch, kSlabBlocks);
+            }
+        }
+
+    private:
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        static constexpr size_t kBlockSize =
+                (std::max(BlockSize, sizeof(FreeBlock)) + Align - 1) / Align * Align;
+
+        enum CacheState { kUnused, kAlive, kDead };
+
+        // Trivially destructible, so it is still usable while other
+        // thread_local objects destruct.
+        struct LocalCache {
+            FreeBlock *head;
+            size_t count;
+            CacheState state;
+        };
+
+        // Return the local free list to the depot when thread exits.
+        struct CacheGuard {
+            ~CacheGuard() {
+                LocalCache &cache = local_cache_;
+                if (cache.head != nullptr) PushBatch(cache.head, cache.count);
+                cache.head = nullptr;
+                cache.count = 0;
+                cache.state = kDead;
+            }
+        };
+
+        struct Depot {
+            std::mutex mutex;
+            std::vector<std::pair<FreeBlock *, size_t>> batches;
+        };
+
+        // Depot is never destructed, nodes may be released during static
+        // destruction after it.
+        static Depot &GetDepot() {
+            static auto *depot = new Depot();
+            return *depot;
+        }
+
+        static bool Attach(LocalCache &cache) {
+            if (cache.state == kDead) return false;
+            thread_local CacheGuard guard;  // Register flush on thread exit.
+            (void) guard;
+            cache.state = kAlive;
+            return true;
+        }
+
+        static void PushBatch(FreeBlock *head, size_t count) {
+            Depot &depot = GetDepot();
+            std::lock_guard<std::mutex> lock(depot.mutex);
+            depot.batches.emplace_back(head, count);
+        }
+
+        // Refill an empty cache with a batch from depot or a brand-new slab.
+        static void Refill(LocalCache &cache) {
+            Depot &depot = GetDepot();
+            {
+                std::lock_guard<std::mutex> lock(depot.mutex);
+                if (!depot.batches.empty()) {
+                    cache.head = depot.batches.back().first;
+                    cache.count = depot.batches.back().second;
+                    depot.batches.pop_back();
+                    return;
+                }
+            }
+
+            auto *slab = static_cast<char *>(
+                    ::operator new(kSlabBlocks * kBlockSize, std::align_val_t(Align)));
+            FreeBlock *head = nullptr;
+            for (size_t i = kSlabBlocks; i-- > 0;) {
+                auto *block = reinterpret_cast<FreeBlock *>(slab + i * kBlockSize);
+                block->next = head;
+                head = block;
+            }
+            cache.head = head;
+            cache.count = kSlabBlocks;
+        }
+
+        inline static thread_local LocalCache local_cache_{nullptr, 0, kUnused};
+    };
+
+    // Allocate nodes with plain new and delete.
+    struct HeapNodeAllocator {
+        template<typename T, typename... Args>
+        static T *New(Args &&... args) {
+            return new T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        static void Delete(T *node) { delete node; }
+    };
+
+    // Allocate nodes from per-thread slabs, nodes of the same size share a pool.
+    struct PooledNodeAllocator {
+        template<typename T, typename... Args>
+        static T *New(Args &&... args) {
+            void *ptr = NodePool<sizeof(T), alignof(T)>::Allocate();
+            return new(ptr) T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        static void Delete(T *node) {
+            node->~T();
+            NodePool<sizeof(T), alignof(T)>::Deallocate(node);
+        }
+    };
+
+}  // namespace eht
@@ -0,0 +1,31 @@
+//
+// Created by Chaos Zhai on 12/17/23.
+//
+#pragma once
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace eht {
+
+    // Number of threads used by bulk operations when the caller does not say.
+    inline size_t DefaultThreads() {
+        size_t threads = std::thread::hardware_concurrency();
+        return threads == 0 ? 1 : threads;
+    }
+
+    // Run fn(0) .. fn(n - 1) on n threads, fn(0) runs on the calling thread.
+    template<typename F>
+    void ParallelFor(size_t n, F &&fn) {
+        std::vector<std::thread> workers;
+        workers.reserve(n);
+        for (size_t i = 1; i < n; ++i) {
+            workers.emplace_back(std::ref(fn), i);
+        }
+        if (n > 0) fn(0);
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+}  // namespace eht
@@ -0,0 +1,122 @@
+//
+// Created by Chaos Zhai on 12/18/23.
+//
+#pragma once
+#include <memory>
+#include <utility>
+#include "table_reclaimer.h"
+#include "thread_slot.h"
+#include "../../lib/hazardPointer/hazardPointer.h"
+
+namespace eht {
+
+    /**
+     * A reclamation policy of LockFreeHashTable is a type with a member class
+     * Domain. A table owns a domain, or shares one with other tables, and
+     * nodes retired by the table are reclaimed within its domain only:
+     *   Guard     held by every operation of the table for its whole run,
+     *             Guard(domain).
+     *   Hazard    protects one pointer, Hazard(&reclaimer, ptr) and UnMark().
+     *   Local()   reclaimer of calling thread in the domain, with
+     *             ReclaimLater(ptr, func) and TryReclaim().
+     *   kNeedsValidation  true if a pointer marked by Hazard is safe only
+     *             after re-reading where it was loaded from.
+     * Reclaimers belong to the domain and are destroyed when their thread
+     * exits, handing what they retired over to other threads of the domain.
+     * A domain must outlive every operation on it, and everything retired in
+     * it is reclaimed when it is destroyed.
+     */
+
+    // Hazard pointers, see lib/hazardPointer. Every node visited is marked.
+    struct HazardPointerReclamation {
+        class Domain {
+        public:
+            using Hazard = HazardPointer;
+
+            // Threads scan hazard pointers themselves when enough nodes are
+            // retired.
+            Domain() = default;
+
+            /**
+             * Threads hand retired nodes over to a reclaimer thread, at most
+             * background_batches batches wait for it before they scan
+             * themselves again. Removes and updates then do not pay for
+             * scans, at the cost of one thread and more memory held back.
+             */
+            explicit Domain(size_t background_batches)
+                    : background_(std::make_unique<BackgroundReclaimer>(hp_list_, background_batches)) {}
+
+            class Guard {
+            public:
+                explicit Guard(Domain &) {}
+            };
+
+            static constexpr bool kNeedsValidation = true;
+
+            // Scans only see hazard pointers of threads that used the domain.
+            TableReclaimer &Local() {
+                return reclaimers_.Local([this] {
+                    return new TableReclaimer(hp_list_, background_.get());
+                });
+            }
+
+        private:
+            HazardPointerList hp_list_;  // Destroyed after reclaimers_.
+            std::unique_ptr<BackgroundReclaimer> background_;
+            PerThread<TableReclaimer> reclaimers_;
+        };
+    };
+
+    // Epoch based reclamation, see lib/epoch. Operations announce the epoch
+    // once and read nodes for free.
+    struct EpochReclamation {
+        class Domain {
+        public:
+            // Nothing to mark, the guard of operation protects every node.
+            class Hazard {
+            public:
+                Hazard() = default;
+
+                Hazard(EpochReclaimer *, void *) {}
+
+                void UnMark() {}
+            };
+
+            class Guard {
+            public:
+                explicit Guard(Domain &domain) : reclaimer_(&domain.Local()) { reclaimer_->Enter(); }
+
+                ~Guard() {
+                    if (reclaimer_ != nullptr) reclaimer_->Exit();
+                }
+
+                Guard(const Guard &other) = delete;
+                Guard &operator=(const Guard &other) = delete;
+
+                Guard(Guard &&other) noexcept : reclaimer_(other.reclaimer_) {
+                    other.reclaimer_ = nullptr;
+                }
+
+                Guard &operator=(Guard &&other) noexcept {
+                    std::swap(reclaimer_, other.reclaimer_);
+                    return *this;
+                }
+
+            private:
+                EpochReclaimer *reclaimer_;
+            };
+
+            static constexpr bool kNeedsValidation = false;
+
+            // The epoch only waits for threads inside an operation on the domain.
+            TableEpochReclaimer &Local() {
+                return reclaimers_.Local([this] { return new TableEpochReclaimer(records_); });
+            }
+
+        private:
+            EpochRecordList records_;  // Destroyed after reclaimers_.
+            PerThread<TableEpochReclaimer> reclaimers_;
+        };
+    };
+
+}  // namespace eht
@@ -0,0 +1,70 @@
+//
+// Created by Chaos Zhai on 12/17/23.
+//
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace eht {
+
+    const size_t kCacheLineSize = 64;
+    const size_t kMaxCounterStripes = 64;
+
+    /**
+     * StripedCounter spreads a counter over cache-line-padded cells, a thread
+     * always adds to the same cell so writers on different cores do not share
+     * a cache line. Reading the total sums all cells.
+     */
+    class StripedCounter {
+    public:
+        StripedCounter() : stripes_(DefaultStripes()), cells_(new Cell[stripes_]) {}
+
+        // Disable copy and move.
+        StripedCounter(const StripedCounter &other) = delete;
+        StripedCounter &operator=(const StripedCounter &other) = delete;
+
+        // Add delta to the cell of calling thread and return its new value.
+        int64_t Add(int64_t delta) {
+            Cell &cell = cells_[ThreadIndex() & (stripes_ - 1)];
+            return cell.value.fetch_add(delta, std::memory_order_relaxed) + delta;
+        }
+
+        // Sum of all cells, exact if no Add runs concurrently.
+        int64_t Sum() const {
+            int64_t sum = 0;
+            for (size_t i = 0; i < stripes_; ++i) {
+                sum += cells_[i].value.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        size_t stripes() const { return stripes_; }
+
+    private:
+        struct alignas(kCacheLineSize) Cell {
+            std::atomic<int64_t> value{0};
+        };
+
+        // Smallest power of 2 not less than the number of cores.
+        static size_t DefaultStripes() {
+            size_t stripes = 1;
+            while (stripes < kMaxCounterStripes && stripes < std::thread::hardware_concurrency()) {
+                stripes <<= 1;
+            }
+            return stripes;
+        }
+
+        // Threads are numbered in the order they first touch any counter.
+        static size_t ThreadIndex() {
+            static std::atomic<size_t> next_index{0};
+            thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+
+        const size_t stripes_;
+        std::unique_ptr<Cell[]> cells_;
+    };
+
+}  // namespace eht
@@ -3,22 +3,28 @@
 //
 #pragma once
 #include "../../lib/hazardPointer/reclaimer.h"
+#include "../../lib/epoch/epochReclaimer.h"
 
 namespace eht {
 
-    template<typename K, typename V>
+    // Reclaimer of one thread in one reclamation domain, owned by the domain.
     class TableReclaimer : public Reclaimer {
 
     public:
-        explicit TableReclaimer(HazardPointerList &hp_list) : Reclaimer(hp_list) {}
+        TableReclaimer(HazardPointerList &hp_list, BackgroundReclaimer *background)
+                : Reclaimer(hp_list, background) {}
 
         ~TableReclaimer() = default;
 
-        static TableReclaimer<K, V> &GetInstance(HazardPointerList &hp_list) {
-            thread_local static TableReclaimer reclaimer(
-                    hp_list);  // thread_local: each thread has its own instance.
-            return reclaimer;
-        }
+        void TryReclaim() { ReclaimNoHazardPointer(); }
     };
 
-}
\ No newline at end of file
+    class TableEpochReclaimer : public EpochReclaimer {
+
+    public:
+        explicit TableEpochReclaimer(EpochRecordList &list) : EpochReclaimer(list) {}
+
+        ~TableEpochReclaimer() = default;
+    };
+
+}
@@ -0,0 +1,199 @@
+//
+// Created by Chaos Zhai on 12/19/23.
+//
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace eht {
+
+    // PerThread keeps values of this many thread slots per chunk.
+    const size_t kPerThreadChunkSize = 64;
+
+    /**
+     * A thread slot is a small integer unique among live threads. Slots of
+     * exited threads are handed out again lowest first, so slots stay dense
+     * however many threads come and go.
+     */
+    class ThreadSlot {
+    public:
+        using ExitFunc = void (*)(void *context, size_t slot);
+
+        static size_t Get() {
+            thread_local Holder holder;
+            return holder.slot;
+        }
+
+        // Call func(context, slot) when a thread that called Get exits, until
+        // Unsubscribe(context). It runs before the slot is handed out again,
+        // without the registry locked, so it may Subscribe and Unsubscribe.
+        static void Subscribe(void *context, ExitFunc func) {
+            Registry &registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.exit_funcs.emplace_back(context, func);
+        }
+
+        // No exit function of context runs after Unsubscribe returns, calls
+        // by other threads are waited for. Called by an exit function of
+        // context, that call is left to finish.
+        static void Unsubscribe(void *context) {
+            Registry &registry = GetRegistry();
+            std::unique_lock<std::mutex> lock(registry.mutex);
+            auto &exit_funcs = registry.exit_funcs;
+            exit_funcs.erase(std::remove_if(exit_funcs.begin(), exit_funcs.end(),
+                                            [context](const std::pair<void *, ExitFunc> &entry) {
+                                                return entry.first == context;
+                                            }),
+                             exit_funcs.end());
+            std::thread::id self = std::this_thread::get_id();
+            registry.exited.wait(lock, [&registry, context, self]() {
+                return std::none_of(registry.running.begin(), registry.running.end(),
+                                    [context, self](const std::pair<void *, std::thread::id> &call) {
+                                        return call.first == context && call.second != self;
+                                    });
+            });
+        }
+
+    private:
+        struct Registry {
+            std::mutex mutex;
+            std::vector<size_t> free_slots;
+            size_t next_slot = 0;
+            std::vector<std::pair<void *, ExitFunc>> exit_funcs;
+            // Exit functions being called, by context and calling thread.
+            std::vector<std::pair<void *, std::thread::id>> running;
+            std::condition_variable exited;
+        };
+
+        // Registry is never destructed, threads may exit during static
+        // destruction after it.
+        static Registry &GetRegistry() {
+            static auto *registry = new Registry();
+            return *registry;
+        }
+
+        struct Holder {
+            Holder() {
+                Registry &registry = GetRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                auto &free_slots = registry.free_slots;
+                if (free_slots.empty()) {
+                    slot = registry.next_slot++;
+                } else {
+                    auto it = std::min_element(free_slots.begin(), free_slots.end());
+                    slot = *it;
+                    free_slots.erase(it);
+                }
+            }
+
+            ~Holder() {
+                Registry &registry = GetRegistry();
+                std::unique_lock<std::mutex> lock(registry.mutex);
+                // Functions run unlocked, each only if still subscribed then.
+                auto exit_funcs = registry.exit_funcs;
+                std::thread::id self = std::this_thread::get_id();
+                for (auto &entry: exit_funcs) {
+                    auto &current = registry.exit_funcs;
+                    if (std::find(current.begin(), current.end(), entry) == current.end()) continue;
+                    registry.running.emplace_back(entry.first, self);
+                    lock.unlock();
+                    entry.second(entry.first, slot);
+                    lock.lock();
+                    auto &running = registry.running;
+                    running.erase(std::find(running.begin(), running.end(),
+                                            std::make_pair(entry.first, self)));
+                    registry.exited.notify_all();
+                }
+                registry.free_slots.push_back(slot);
+            }
+
+            size_t slot;
+        };
+    };
+
+    /**
+     * PerThread holds one T per thread slot, created on first use by the
+     * thread owning the slot. A value is destroyed when its thread exits,
+     * the rest are destroyed with PerThread.
+     */
+    template<typename T>
+    class PerThread {
+    public:
+        PerThread() { ThreadSlot::Subscribe(this, OnThreadExit); }
+
+        ~PerThread() {
+            ThreadSlot::Unsubscribe(this);
+            Chunk *chunk = &first_;
+            while (chunk != nullptr) {
+                for (auto &value: chunk->values) {
+                    delete value.load(std::memory_order_acquire);
+                }
+                Chunk *next = chunk->next.load(std::memory_order_acquire);
+                if (chunk != &first_) delete chunk;
+                chunk = next;
+            }
+        }
+
+        // Disable copy and move.
+        PerThread(const PerThread &other) = delete;
+        PerThread &operator=(const PerThread &other) = delete;
+
+        // Value of calling thread, make() returns a new T if there is none.
+        template<typename Make>
+        T &Local(Make &&make) {
+            size_t slot = ThreadSlot::Get();
+            Chunk *chunk = &first_;
+            while (slot >= kPerThreadChunkSize) {
+                Chunk *next = chunk->next.load(std::memory_order_acquire);
+                if (next == nullptr) {
+                    auto *new_chunk = new Chunk();
+                    if (chunk->next.compare_exchange_strong(next, new_chunk,
+                                                            std::memory_order_acq_rel)) {
+                        next = new_chunk;
+                    } else {
+                        delete new_chunk;
+                    }
+                }
+                chunk = next;
+                slot -= kPerThreadChunkSize;
+            }
+
+            T *value = chunk->values[slot].load(std::memory_order_acquire);
+            if (value == nullptr) {
+                value = make();
+                chunk->values[slot].store(value, std::memory_order_release);
+            }
+            return *value;
+        }
+
+    private:
+        // Called by an exiting thread, which alone accesses the value of slot.
+        static void OnThreadExit(void *context, size_t slot) {
+            Chunk *chunk = &static_cast<PerThread *>(context)->first_;
+            while (slot >= kPerThreadChunkSize) {
+                chunk = chunk->next.load(std::memory_order_acquire);
+                if (chunk == nullptr) return;
+                slot -= kPerThreadChunkSize;
+            }
+            delete chunk->values[slot].exchange(nullptr, std::memory_order_acq_rel);
+        }
+
+        struct Chunk {
+            Chunk() {
+                for (auto &value: values) value.store(nullptr, std::memory_order_relaxed);
+            }
+
+            std::atomic<T *> values[kPerThreadChunkSize];
+            std::atomic<Chunk *> next{nullptr};
+        };
+
+        Chunk first_;
+    };
+
+}  // namespace eht
@@ -0,0 +1,335 @@
+//
+// Created by Chaos Zhai on 12/16/23.
+//
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace eht {
+
+    // Trivially copyable values up to this size are stored inside the node.
+    const size_t kMaxInlineValueSize = 64;
+
+    /**
+     * Every slot can be frozen once, by the deletion of its node before the
+     * node is marked. Writes fail on a frozen slot, so the value read by
+     * Extract is final and no update is lost with the node. Reads go on.
+     */
+    enum class ValueMode {
+        kPointer,  // Value is heap allocated, node holds std::atomic<V *>.
+        kAtomic,   // Value is stored inline in a lock-free word with the frozen flag.
+        kSeqLock   // Value is stored inline and guarded by a per-node seqlock.
+    };
+
+    template<typename V>
+    constexpr ValueMode DefaultValueMode() {
+        if constexpr (!std::is_trivially_copyable_v<V> ||
+                      !std::is_default_constructible_v<V>) {
+            return ValueMode::kPointer;
+        } else if constexpr (sizeof(V) < sizeof(uint64_t) &&
+                             std::atomic<uint64_t>::is_always_lock_free) {
+            return ValueMode::kAtomic;
+        } else if constexpr (sizeof(V) <= kMaxInlineValueSize) {
+            return ValueMode::kSeqLock;
+        } else {
+            return ValueMode::kPointer;
+        }
+    }
+
+    // Specialize ValueTraits to force a value representation for V.
+    template<typename V>
+    struct ValueTraits {
+        static constexpr ValueMode mode = DefaultValueMode<V>();
+    };
+
+    template<typename V, ValueMode Mode = ValueTraits<V>::mode>
+    class ValueSlot;
+
+    // Value lives on heap, updating a value swaps the pointer and the old value
+    // must be reclaimed through hazard pointers by the caller. Freeze sets the
+    // lowest bit of ptr, which operator new leaves clear.
+    template<typename V>
+    class ValueSlot<V, ValueMode::kPointer> {
+    public:
+        static constexpr bool kInline = false;
+
+        static bool IsFrozen(const V *value) {
+            return (reinterpret_cast<uintptr_t>(value) & 0x1) != 0;
+        }
+
+        // The value a pointer loaded from ptr refers to.
+        static V *Unfrozen(V *value) {
+            return reinterpret_cast<V *>(reinterpret_cast<uintptr_t>(value) & ~uintptr_t(0x1));
+        }
+
+        ValueSlot() : ptr(nullptr) {}
+
+        explicit ValueSlot(const V &value) : ptr(new V(value)) {}
+
+        explicit ValueSlot(V &&value) : ptr(new V(std::move(value))) {}
+
+        template<typename... Args>
+        explicit ValueSlot(std::in_place_t, Args &&... args)
+                : ptr(new V(std::forward<Args>(args)...)) {}
+
+        ~ValueSlot() {
+            V *value = Unfrozen(ptr.load(std::memory_order_consume));
+            delete value;  // If update a node, value of this node is nullptr.
+        }
+
+        bool IsFrozen() const { return IsFrozen(ptr.load(std::memory_order_acquire)); }
+
+        // Return false if already frozen.
+        bool Freeze() {
+            V *value = ptr.load(std::memory_order_relaxed);
+            do {
+                if (IsFrozen(value)) return false;
+            } while (!ptr.compare_exchange_weak(
+                    value, reinterpret_cast<V *>(reinterpret_cast<uintptr_t>(value) | 0x1),
+                    std::memory_order_acq_rel, std::memory_order_relaxed));
+            return true;
+        }
+
+        std::atomic<V *> ptr;
+    };
+
+    // Value takes the first sizeof(V) bytes of one word, the last byte is
+    // the frozen flag.
+    template<typename V>
+    class ValueSlot<V, ValueMode::kAtomic> {
+    public:
+        static constexpr bool kInline = true;
+
+        ValueSlot() : word_(Pack(V(), false)) {}
+
+        explicit ValueSlot(const V &value) : word_(Pack(value, false)) {}
+
+        template<typename... Args>
+        explicit ValueSlot(std::in_place_t, Args &&... args)
+                : word_(Pack(V(std::forward<Args>(args)...), false)) {}
+
+        V Load() const { return Unpack(word_.load(std::memory_order_acquire)); }
+
+        // Return false if frozen.
+        bool Store(const V &value) {
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            do {
+                if (IsFrozen(word)) return false;
+            } while (!word_.compare_exchange_weak(word, Pack(value, false),
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+            return true;
+        }
+
+        // Replace value with fn(value) atomically, fn may be called more than
+        // once. Return false if frozen.
+        template<typename F>
+        bool Update(F &&fn) {
+            uint64_t word = word_.load(std::memory_order_acquire);
+            do {
+                if (IsFrozen(word)) return false;
+            } while (!word_.compare_exchange_weak(word, Pack(fn(Unpack(word)), false),
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_acquire));
+            return true;
+        }
+
+        // Values are compared with operator==, if not equal then expected is
+        // set to the current value. Also false if frozen, see IsFrozen.
+        bool CompareExchange(V &expected, const V &desired) {
+            uint64_t word = word_.load(std::memory_order_acquire);
+            while (true) {
+                V current = Unpack(word);
+                if (!(current == expected)) {
+                    expected = current;
+                    return false;
+                }
+                if (IsFrozen(word)) return false;
+                if (word_.compare_exchange_weak(word, Pack(desired, false),
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                    return true;
+                }
+            }
+        }
+
+        bool IsFrozen() const { return IsFrozen(word_.load(std::memory_order_acquire)); }
+
+        // Return false if already frozen.
+        bool Freeze() {
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            do {
+                if (IsFrozen(word)) return false;
+            } while (!word_.compare_exchange_weak(word, Pack(Unpack(word), true),
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed));
+            return true;
+        }
+
+    private:
+        static constexpr size_t kFlagByte = sizeof(uint64_t) - 1;
+
+        static uint64_t Pack(const V &value, bool frozen) {
+            unsigned char bytes[sizeof(uint64_t)] = {};
+            std::memcpy(bytes, &value, sizeof(V));
+            bytes[kFlagByte] = frozen;
+            uint64_t word;
+            std::memcpy(&word, bytes, sizeof(word));
+            return word;
+        }
+
+        static V Unpack(uint64_t word) {
+            V value;
+            std::memcpy(&value, &word, sizeof(V));
+            return value;
+        }
+
+        static bool IsFrozen(uint64_t word) {
+            unsigned char bytes[sizeof(uint64_t)];
+            std::memcpy(bytes, &word, sizeof(word));
+            return bytes[kFlagByte] != 0;
+        }
+
+        std::atomic<uint64_t> word_;
+    };
+
+    // Value is copied in and out word by word, readers retry when a writer
+    // changed the sequence number meanwhile. Every word is atomic so readers
+    // racing with a writer never read torn memory in the sense of the C++
+    // memory model, they only discard the copy.
+    template<typename V>
+    class ValueSlot<V, ValueMode::kSeqLock> {
+    public:
+        static constexpr bool kInline = true;
+
+        ValueSlot() : seq_(0) {
+            for (auto &word: words_) word.store(0, std::memory_order_relaxed);
+        }
+
+        explicit ValueSlot(const V &value) : seq_(0) { Write(value); }
+
+        template<typename... Args>
+        explicit ValueSlot(std::in_place_t, Args &&... args) : seq_(0) {
+            Write(V(std::forward<Args>(args)...));
+        }
+
+        V Load() const {
+            uint64_t buffer[kWords];
+            while (true) {
+                uint64_t seq = seq_.load(std::memory_order_acquire);
+                if (seq & 0x1) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (size_t i = 0; i < kWords; ++i) {
+                    buffer[i] = words_[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq_.load(std::memory_order_relaxed) == seq) break;
+            }
+            V value;
+            std::memcpy(&value, buffer, sizeof(V));
+            return value;
+        }
+
+        // Return false if frozen.
+        bool Store(const V &value) {
+            uint64_t seq;
+            if (!LockWriter(&seq)) return false;
+            Write(value);
+            UnlockWriter(seq);
+            return true;
+        }
+
+        // Replace value with fn(value) atomically, fn runs once with the
+        // writer lock held. Return false if frozen.
+        template<typename F>
+        bool Update(F &&fn) {
+            uint64_t seq;
+            if (!LockWriter(&seq)) return false;
+            Write(fn(static_cast<const V &>(Read())));
+            UnlockWriter(seq);
+            return true;
+        }
+
+        // Values are compared with operator==, if not equal then expected is
+        // set to the current value. Also false if frozen, see IsFrozen.
+        bool CompareExchange(V &expected, const V &desired) {
+            uint64_t seq;
+            if (!LockWriter(&seq)) {
+                expected = Load();
+                return false;
+            }
+            V current = Read();
+            bool equal = current == expected;
+            if (equal) {
+                Write(desired);
+            } else {
+                expected = current;
+            }
+            UnlockWriter(seq);
+            return equal;
+        }
+
+        bool IsFrozen() const { return (seq_.load(std::memory_order_acquire) & kFrozen) != 0; }
+
+        // Return false if already frozen.
+        bool Freeze() {
+            uint64_t seq;
+            if (!LockWriter(&seq)) return false;
+            seq_.store((seq + 2) | kFrozen, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        static constexpr size_t kWords = (sizeof(V) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        // Set in seq_ by Freeze, writers never lock seq_ again.
+        static constexpr uint64_t kFrozen = uint64_t(1) << 63;
+
+        // Writers exclude each other by moving seq_ from even to odd. Return
+        // false if frozen.
+        bool LockWriter(uint64_t *seq_ptr) {
+            uint64_t seq = seq_.load(std::memory_order_relaxed);
+            do {
+                while (seq & 0x1) {
+                    std::this_thread::yield();
+                    seq = seq_.load(std::memory_order_relaxed);
+                }
+                if (seq & kFrozen) return false;
+            } while (!seq_.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire,
+                                                 std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_release);
+            *seq_ptr = seq;
+            return true;
+        }
+
+        void UnlockWriter(uint64_t seq) { seq_.store(seq + 2, std::memory_order_release); }
+
+        // Read words while holding the writer lock.
+        V Read() const {
+            uint64_t buffer[kWords];
+            for (size_t i = 0; i < kWords; ++i) {
+                buffer[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            V value;
+            std::memcpy(&value, buffer, sizeof(V));
+            return value;
+        }
+
+        void Write(const V &value) {
+            uint64_t buffer[kWords] = {};
+            std::memcpy(buffer, &value, sizeof(V));
+            for (size_t i = 0; i < kWords; ++i) {
+                words_[i].store(buffer[i], std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<uint64_t> seq_;  // Odd while a writer is copying in.
+        std::atomic<uint64_t> words_[kWords];
+    };
+
+}  // namespace eht
@@ -0,0 +1,134 @@
+//
+// Created by Chaos Zhai on 12/18/23.
+//
+
+#include <algorithm>
+#include <mutex>
+#include "epochReclaimer.h"
+namespace eht {
+
+    void EpochReclaimer::ReclaimLater(void *const ptr, DeleteFunc func) {
+        // ptr is unlinked before the epoch is read, so a thread that announced
+        // a later epoch can not reach it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = list_.epoch.load(std::memory_order_relaxed);
+        Limbo &limbo = limbo_[epoch % limboLists];
+        if (limbo.epoch != epoch) {
+            // The list holds pointers at least three epochs old.
+            Reclaim(limbo);
+            limbo.epoch = epoch;
+        }
+        limbo.ptrs.push_back({ptr, func, epoch});
+        ++retired_;
+    }
+
+    void EpochReclaimer::TryReclaim() {
+        if (retired_ < collectInterval) return;
+        retired_ = 0;
+
+        TryAdvance();
+        uint64_t epoch = list_.epoch.load(std::memory_order_acquire);
+        for (auto &limbo: limbo_) {
+            if (limbo.epoch + 2 <= epoch) Reclaim(limbo);
+        }
+        if (list_.orphan_count.load(std::memory_order_relaxed) > 0) {
+            ReclaimOrphans(epoch);
+        }
+    }
+
+    bool EpochReclaimer::TryAdvance() {
+        uint64_t epoch = list_.epoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        EpochRecord *p = list_.head.load(std::memory_order_acquire);
+        while (p) {
+            uint64_t state = p->state.load(std::memory_order_relaxed);
+            if ((state & 1) && (state >> 1) != epoch) return false;
+            p = p->next.load(std::memory_order_acquire);
+        }
+        // Synchronize with Exit of the threads seen outside an operation.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return list_.epoch.compare_exchange_strong(epoch, epoch + 1,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed);
+    }
+
+    void EpochReclaimer::Reclaim(Limbo &limbo) {
+        for (auto &retired: limbo.ptrs) {
+            retired.delete_func(retired.ptr);
+        }
+        limbo.ptrs.clear();
+    }
+
+    void EpochReclaimer::ReclaimOrphans(uint64_t epoch) {
+        std::unique_lock<std::mutex> lock(list_.orphan_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return;
+
+        auto &orphans = list_.orphans;
+        auto it = std::partition(orphans.begin(), orphans.end(), [epoch](const RetiredPtr &retired) {
+            return retired.epoch + 2 > epoch;
+        });
+        for (auto reclaim = it; reclaim != orphans.end(); ++reclaim) {
+            reclaim->delete_func(reclaim->ptr);
+        }
+        orphans.erase(it, orphans.end());
+        list_.orphan_count.store(orphans.size(), std::memory_order_relaxed);
+    }
+
+    void EpochReclaimer::AcquireRecord() {
+        std::atomic<EpochRecord *> &head = list_.head;
+        EpochRecord *p = head.load(std::memory_order_acquire);
+        while (p) {
+            // Try to get the idle record that's previously false.
+            if (!p->flag.test_and_set()) {
+                record_ = p;
+                return;
+            }
+            p = p->next.load(std::memory_order_acquire);
+        }
+
+        // No idle record, allocate new one.
+        auto *new_head = new EpochRecord();
+        new_head->flag.test_and_set();
+        EpochRecord *old_head = head.load(std::memory_order_acquire);
+        new_head->next = old_head;
+        while (!head.compare_exchange_weak(old_head, new_head,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+            new_head->next = old_head;
+        }
+        record_ = new_head;
+    }
+
+    EpochReclaimer::EpochReclaimer(EpochRecordList &list)
+            : list_(list), record_(nullptr), nesting_(0), retired_(0) {
+        AcquireRecord();
+    }
+
+    EpochReclaimer::~EpochReclaimer() {
+        // The EpochReclaimer destruct with its domain, or when its thread exit.
+        // If assert failed, you should make sure no operation or cursor is
+        // alive before that.
+        assert(nesting_ == 0);
+
+        // 1.Reclaim what is old enough already.
+        TryAdvance();
+        uint64_t epoch = list_.epoch.load(std::memory_order_acquire);
+        for (auto &limbo: limbo_) {
+            if (limbo.epoch + 2 <= epoch) Reclaim(limbo);
+        }
+
+        // 2.Hand over the rest to other threads and give up the record.
+        {
+            std::lock_guard<std::mutex> lock(list_.orphan_mutex);
+            for (auto &limbo: limbo_) {
+                for (auto &retired: limbo.ptrs) {
+                    list_.orphans.push_back(retired);
+                }
+            }
+            list_.orphan_count.store(list_.orphans.size(), std::memory_order_relaxed);
+        }
+        record_->state.store(0, std::memory_order_release);
+        record_->flag.clear(std::memory_order_release);
+    }
+
+}
@@ -0,0 +1,101 @@
+//
+// Created by Chaos Zhai on 12/18/23.
+//
+#pragma once
+
+#ifndef LOCK_FREE_EHT_EPOCH_RECLAIMER_H
+#define LOCK_FREE_EHT_EPOCH_RECLAIMER_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "epochRecord.h"
+
+namespace eht {
+
+    /**
+     * EpochReclaimer is the per-thread side of epoch based reclamation.
+     * A thread announces the global epoch while it is inside an operation,
+     * and the global epoch advances only once every thread inside an
+     * operation has announced it. A pointer retired in epoch e is therefore
+     * unreachable once the global epoch reaches e + 2, so retired pointers
+     * wait in three limbo lists indexed by epoch % 3.
+     * Unlike hazard pointers, reading a node costs nothing, but a thread that
+     * stays inside an operation holds back reclamation of all threads.
+     */
+    class EpochReclaimer {
+    private:
+        // Try to advance the global epoch once this many pointers are retired.
+        static const int collectInterval = 64;
+        static const int limboLists = 3;
+
+    public:
+        // Frees a retired pointer, a plain function so that retiring costs
+        // no allocation.
+        using DeleteFunc = void (*)(void *);
+
+        // delete copy and move constructors
+        EpochReclaimer(const EpochReclaimer &) = delete;
+        EpochReclaimer(EpochReclaimer &&) = delete;
+        EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+        EpochReclaimer &operator=(EpochReclaimer &&) = delete;
+
+        // Announce the global epoch, nodes read until the matching Exit are
+        // not reclaimed. Calls nest.
+        void Enter() {
+            if (nesting_++ > 0) return;
+            uint64_t epoch = list_.epoch.load(std::memory_order_relaxed);
+            record_->state.store((epoch << 1) | 1, std::memory_order_relaxed);
+            // Announcement must be visible before any node is read.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        void Exit() {
+            assert(nesting_ > 0);
+            if (--nesting_ > 0) return;
+            uint64_t state = record_->state.load(std::memory_order_relaxed);
+            record_->state.store(state & ~1UL, std::memory_order_release);
+        }
+
+        // ptr must be unlinked already, reclaim it two epochs later.
+        void ReclaimLater(void *ptr, DeleteFunc func);
+
+        // Try to advance the global epoch and reclaim limbo lists that are
+        // old enough, at most once per collectInterval retired pointers.
+        void TryReclaim();
+
+    protected:
+        explicit EpochReclaimer(EpochRecordList &list);
+
+        ~EpochReclaimer();
+
+    private:
+        struct Limbo {
+            uint64_t epoch = 0;
+            std::vector<RetiredPtr> ptrs;
+        };
+
+        // Advance the global epoch if every thread inside an operation has
+        // announced it.
+        bool TryAdvance();
+
+        // Call delete functions of limbo and clear it.
+        static void Reclaim(Limbo &limbo);
+
+        // Reclaim orphans of exited threads retired before epoch - 1.
+        void ReclaimOrphans(uint64_t epoch);
+
+        // Take an idle record of list or allocate a new one.
+        void AcquireRecord();
+
+        EpochRecordList &list_;
+        EpochRecord *record_;
+        int nesting_;
+        int retired_;  // Retired since the last TryAdvance.
+        Limbo limbo_[limboLists];
+    };
+
+}  // namespace eht
+
+#endif //LOCK_FREE_EHT_EPOCH_RECLAIMER_H
@@ -0,0 +1,79 @@
+//
+// Created by Chaos Zhai on 12/18/23.
+//
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace eht {
+
+    // Node and hazard pointer records are read by every scan, keep epoch
+    // records and the global epoch on cache lines of their own.
+    const size_t kEpochCacheLineSize = 64;
+
+/**
+ * EpochRecord announces the epoch of one thread, it is a node of
+ * EpochRecordList. state is (epoch << 1) | 1 while the thread is inside an
+ * operation and has its lowest bit cleared otherwise.
+ */
+    class alignas(kEpochCacheLineSize) EpochRecord {
+    public:
+        EpochRecord() : state(0), next(nullptr) {}
+
+        ~EpochRecord() = default;
+
+        // not copy-able
+        // delete move constructors
+        EpochRecord(const EpochRecord &other) = delete;
+
+        EpochRecord(EpochRecord &&other) = delete;
+
+        EpochRecord &operator=(const EpochRecord &other) = delete;
+
+        EpochRecord &operator=(EpochRecord &&other) = delete;
+
+        std::atomic_flag flag{};  // Owned by a thread.
+        std::atomic<uint64_t> state;
+        std::atomic<EpochRecord *> next;
+    };
+
+    // A pointer waiting for reclamation, retired in epoch.
+    struct RetiredPtr {
+        void *ptr;
+        void (*delete_func)(void *);
+        uint64_t epoch;
+    };
+
+/**
+ * EpochRecordList holds the global epoch and the records of all threads that
+ * ever entered an operation. Retired pointers of exited threads are handed
+ * over to orphans and reclaimed by the next thread that collects, or upon
+ * destruction.
+ */
+    class EpochRecordList {
+    public:
+        EpochRecordList() : head(nullptr), epoch(0), orphan_count(0) {}
+
+        ~EpochRecordList() {
+            // EpochRecordList destruct with its domain.
+            for (auto &orphan: orphans) {
+                orphan.delete_func(orphan.ptr);
+            }
+            EpochRecord *p = head.load(std::memory_order_acquire);
+            while (p) {
+                EpochRecord *temp = p;
+                p = p->next.load(std::memory_order_relaxed);
+                delete temp;
+            }
+        }
+
+        std::atomic<EpochRecord *> head;
+        alignas(kEpochCacheLineSize) std::atomic<uint64_t> epoch;
+        alignas(kEpochCacheLineSize) std::atomic<size_t> orphan_count;
+        std::mutex orphan_mutex;
+        std::vector<RetiredPtr> orphans;
+    };
+
+}
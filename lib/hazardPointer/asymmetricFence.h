@@ -0,0 +1,72 @@
+//
+// Created by Chaos Zhai on 12/21/23.
+//
+#pragma once
+
+#ifndef LOCK_FREE_EHT_ASYMMETRIC_FENCE_H
+#define LOCK_FREE_EHT_ASYMMETRIC_FENCE_H
+
+#include <atomic>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__NR_membarrier)
+#include <linux/membarrier.h>
+#define LOCK_FREE_EHT_HAS_MEMBARRIER 1
+#endif
+#endif
+
+namespace eht {
+
+    /**
+     * AsymmetricFence splits a full fence into a cheap side for the frequent
+     * path and an expensive side for the rare one. Light() is only a compiler
+     * barrier, Heavy() runs a full memory barrier on every running thread of
+     * the process with membarrier(2), so a store before Light() is visible
+     * to loads after Heavy() or the other way around, as if both were full
+     * fences. Without private expedited membarrier both are full fences.
+     */
+    class AsymmetricFence {
+    public:
+        static void Light() {
+            if (expedited_) {
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            } else {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        static void Heavy() {
+#if defined(LOCK_FREE_EHT_HAS_MEMBARRIER)
+            if (expedited_) {
+                syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+                return;
+            }
+#endif
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        // True if Heavy() is a membarrier, false on the full fence fallback.
+        static bool Expedited() { return expedited_; }
+
+    private:
+        // The process must register before its first expedited membarrier.
+        static bool Register() {
+#if defined(LOCK_FREE_EHT_HAS_MEMBARRIER)
+            long commands = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+            if (commands < 0 || !(commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) return false;
+            return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+            return false;
+#endif
+        }
+
+        // Set once during static initialization, before any other thread
+        // starts. Until then both sides are full fences.
+        inline static const bool expedited_ = Register();
+    };
+
+}  // namespace eht
+
+#endif //LOCK_FREE_EHT_ASYMMETRIC_FENCE_H
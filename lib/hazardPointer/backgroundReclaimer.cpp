@@ -0,0 +1,69 @@
+//
+// Created by Chaos Zhai on 12/20/23.
+//
+
+#include "backgroundReclaimer.h"
+namespace eht {
+
+    BackgroundReclaimer::BackgroundReclaimer(HazardPointerList &hp_list, size_t max_batches)
+            : hp_list_(hp_list), max_batches_(max_batches), stop_(false),
+              thread_(&BackgroundReclaimer::Run, this) {}
+
+    BackgroundReclaimer::~BackgroundReclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+
+        for (auto &batch: queue_) {
+            pending_.insert(pending_.end(), batch.begin(), batch.end());
+        }
+        queue_.clear();
+        if (!pending_.empty()) hp_list_.PushOrphans(std::move(pending_));
+    }
+
+    bool BackgroundReclaimer::Push(std::vector<ReclaimNode> &batch) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.size() >= max_batches_) return false;
+            queue_.push_back(std::move(batch));
+            batch.clear();
+            if (!spare_.empty()) {
+                batch.swap(spare_.back());
+                spare_.pop_back();
+            }
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    void BackgroundReclaimer::Run() {
+        auto ready = [this] { return stop_ || !queue_.empty(); };
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (pending_.empty()) {
+                cv_.wait(lock, ready);
+            } else {
+                cv_.wait_for(lock, retryInterval, ready);
+            }
+            if (stop_) return;
+
+            while (!queue_.empty()) {
+                auto &batch = queue_.front();
+                pending_.insert(pending_.end(), batch.begin(), batch.end());
+                batch.clear();
+                if (spare_.size() < max_batches_) spare_.push_back(std::move(batch));
+                queue_.pop_front();
+            }
+
+            // Scan without the lock, so Push never waits for it.
+            lock.unlock();
+            snapshot_.Take(hp_list_);
+            ReclaimUnlessHazard(pending_, snapshot_);
+            lock.lock();
+        }
+    }
+
+}
@@ -0,0 +1,69 @@
+//
+// Created by Chaos Zhai on 12/20/23.
+//
+#pragma once
+
+#ifndef LOCK_FREE_EHT_BACKGROUND_RECLAIMER_H
+#define LOCK_FREE_EHT_BACKGROUND_RECLAIMER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "hazardSnapshot.h"
+
+namespace eht {
+
+    /**
+     * BackgroundReclaimer runs a thread that scans hazard pointers and frees
+     * retired nodes handed over in batches by Reclaimer, so that threads
+     * working on the table never scan. At most maxBatches batches wait in
+     * the queue; once it is full Push fails and the caller scans its batch
+     * itself, which bounds the memory held back when the thread falls
+     * behind.
+     */
+    class BackgroundReclaimer {
+    private:
+        // Nodes that were still hazard are scanned again after this long,
+        // unless a new batch arrives earlier.
+        static constexpr std::chrono::milliseconds retryInterval{1};
+
+    public:
+        BackgroundReclaimer(HazardPointerList &hp_list, size_t max_batches);
+
+        // Stop the thread and hand over what is left as orphans of hp_list.
+        ~BackgroundReclaimer();
+
+        // delete copy and move constructors
+        BackgroundReclaimer(const BackgroundReclaimer &) = delete;
+        BackgroundReclaimer(BackgroundReclaimer &&) = delete;
+        BackgroundReclaimer &operator=(const BackgroundReclaimer &) = delete;
+        BackgroundReclaimer &operator=(BackgroundReclaimer &&) = delete;
+
+        /**
+         * Take over all nodes of batch, which is left empty, possibly with
+         * the capacity of an earlier batch. Return false and leave batch
+         * untouched if the queue is full.
+         */
+        bool Push(std::vector<ReclaimNode> &batch);
+
+    private:
+        void Run();
+
+        HazardPointerList &hp_list_;
+        const size_t max_batches_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::vector<ReclaimNode>> queue_;   // Guarded by mutex_.
+        std::vector<std::vector<ReclaimNode>> spare_;  // Emptied batches, guarded by mutex_.
+        bool stop_;                                    // Guarded by mutex_.
+        std::vector<ReclaimNode> pending_;  // Owned by the thread, still hazard.
+        HazardSnapshot snapshot_;           // Owned by the thread.
+        std::thread thread_;                // Started last.
+    };
+
+}  // namespace eht
+
+#endif //LOCK_FREE_EHT_BACKGROUND_RECLAIMER_H
@@ -18,13 +18,16 @@ namespace eht {
 
         HazardPointer(const HazardPointer &other) = delete;
 
-        HazardPointer(HazardPointer &&other) noexcept {
-            *this = std::move(other);
+        HazardPointer(HazardPointer &&other) noexcept
+                : reclaimer_(other.reclaimer_), index(other.index) {
+            other.index = Reclaimer::HP_INDEX_NULL;
         }
 
         HazardPointer &operator=(const HazardPointer &other) = delete;
 
         HazardPointer &operator=(HazardPointer &&other) noexcept {
+            if (this == &other) return *this;
+            UnMark();
             reclaimer_ = other.reclaimer_;
             index = other.index;
 
@@ -34,7 +37,13 @@ namespace eht {
             return *this;
         }
 
-        void UnMark() const { reclaimer_->UnMarkHazard(index); }
+        // Index is given up, so a later UnMark can not clear the slot after it
+        // is reused by another hazard pointer.
+        void UnMark() {
+            if (index == Reclaimer::HP_INDEX_NULL) return;
+            reclaimer_->UnMarkHazard(index);
+            index = Reclaimer::HP_INDEX_NULL;
+        }
 
     public:
         Reclaimer *reclaimer_{};
@@ -0,0 +1,67 @@
+//
+// Created by Chaos Zhai on 12/20/23.
+//
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "asymmetricFence.h"
+#include "internalHazardPointer.h"
+
+namespace eht {
+
+/**
+ * HazardSnapshot is a copy of all hazard pointers of a list, sorted for
+ * binary search once it is too large to search linearly. Its storage is
+ * reused by every Take.
+ */
+    class HazardSnapshot {
+    private:
+        // Hazard pointer snapshots up to this size are searched linearly.
+        static const size_t maxLinearHazards = 16;
+
+    public:
+        // Pointers retired before Take are either seen as hazard or were
+        // found unlinked by the thread that marked them.
+        void Take(const HazardPointerList &hp_list) {
+            AsymmetricFence::Heavy();
+            hazards_.clear();
+            hp_list.ForEachHazard([this](void *ptr) { hazards_.push_back(ptr); });
+            if (hazards_.size() > maxLinearHazards) {
+                std::sort(hazards_.begin(), hazards_.end());
+            }
+        }
+
+        bool Contains(void *const ptr) const {
+            if (hazards_.size() > maxLinearHazards) {
+                return std::binary_search(hazards_.begin(), hazards_.end(), ptr);
+            }
+            // Branch free, so the compiler may compare several pointers at once.
+            bool found = false;
+            for (void *hazard: hazards_) {
+                found |= hazard == ptr;
+            }
+            return found;
+        }
+
+    private:
+        std::vector<void *> hazards_;
+    };
+
+    // Free every node of list not in snapshot. Nodes still hazard are moved
+    // to the front in order, return their number.
+    inline size_t ReclaimUnlessHazard(std::vector<ReclaimNode> &list, const HazardSnapshot &snapshot) {
+        size_t kept = 0;
+        for (size_t i = 0; i < list.size(); ++i) {
+            ReclaimNode node = list[i];
+            if (!snapshot.Contains(node.ptr)) {
+                node.delete_func(node.ptr);
+            } else {
+                list[kept++] = node;
+            }
+        }
+        list.erase(list.begin() + static_cast<std::ptrdiff_t>(kept), list.end());
+        return kept;
+    }
+
+}  // namespace eht
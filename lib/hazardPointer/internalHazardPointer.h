@@ -3,58 +3,162 @@
 //
 #pragma once
 #include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
 
 namespace eht {
 
+    const size_t kHazardCacheLineSize = 64;
+    // Slots of one record, together with the owner flag they fill a cache line.
+    const size_t kHazardSlots = 7;
+    const size_t kHazardRecordsPerChunk = 64;
+
 /**
- * InternalHazardPointer is used to store the hazard pointer.
- * It is a node of HazardPointerList.
+ * HazardRecord is a block of hazard pointer slots owned by one thread.
+ * A thread takes a record once and marks pointers by storing into its
+ * slots, a slot holding nullptr is idle.
  */
-    class InternalHazardPointer {
+    class alignas(kHazardCacheLineSize) HazardRecord {
     public:
-        InternalHazardPointer() : ptr(nullptr), next(nullptr) {}
+        HazardRecord() {
+            for (auto &slot: slots) slot.store(nullptr, std::memory_order_relaxed);
+        }
 
-        ~InternalHazardPointer() = default;
+        ~HazardRecord() = default;
 
         // not copy-able
         // delete move constructors
-        InternalHazardPointer(const InternalHazardPointer &other) = delete;
+        HazardRecord(const HazardRecord &other) = delete;
 
-        InternalHazardPointer(InternalHazardPointer &&other) = delete;
+        HazardRecord(HazardRecord &&other) = delete;
 
-        InternalHazardPointer &operator=(const InternalHazardPointer &other) = delete;
+        HazardRecord &operator=(const HazardRecord &other) = delete;
 
-        InternalHazardPointer &operator=(InternalHazardPointer &&other) = delete;
+        HazardRecord &operator=(HazardRecord &&other) = delete;
 
         // all fields atomic to ensure thread safety
-        std::atomic_flag flag{};
-        std::atomic<void *> ptr;
-        std::atomic<InternalHazardPointer *> next;
+        std::atomic<void *> slots[kHazardSlots];
+        std::atomic_flag owned{};
+    };
+
+    static_assert(sizeof(HazardRecord) == kHazardCacheLineSize, "HazardRecord fills a cache line");
+
+    struct HazardRecordChunk {
+        HazardRecord records[kHazardRecordsPerChunk];
+        std::atomic<HazardRecordChunk *> next{nullptr};
+    };
+
+    // A retired pointer and the function to free it.
+    struct ReclaimNode {
+        void *ptr;
+        void (*delete_func)(void *);
+    };
+
+    // Retired pointers left behind by an exited thread.
+    struct OrphanBatch {
+        std::vector<ReclaimNode> nodes;
+        OrphanBatch *next;
     };
 
 /**
- * HazardPointerList is a list of InternalHazardPointer.
- * It is used to store all hazard pointers.
- * It will free all InternalHazardPointer memory upon destruction.
+ * HazardPointerList holds the hazard records of all threads in chunks of
+ * contiguous records. Records are taken lowest first, so scanners only walk
+ * the first size records. Retired pointers of exited threads wait in a
+ * stack of orphan batches until a live thread scans.
+ * It will free all chunks and orphans upon destruction.
  */
     class HazardPointerList {
     public:
-        HazardPointerList() : head(new InternalHazardPointer()), size(0) {}
+        HazardPointerList() : head(new HazardRecordChunk()), size(0), orphans(nullptr) {}
 
         ~HazardPointerList() {
-            // HazardPointerList destruct when program exit.
-            InternalHazardPointer *p = head.load(std::memory_order_acquire);
+            // HazardPointerList destruct with its domain, no pointer is hazard.
+            OrphanBatch *batch = orphans.load(std::memory_order_acquire);
+            while (batch) {
+                for (auto &node: batch->nodes) node.delete_func(node.ptr);
+                OrphanBatch *temp = batch;
+                batch = batch->next;
+                delete temp;
+            }
+
+            HazardRecordChunk *p = head.load(std::memory_order_acquire);
             while (p) {
-                InternalHazardPointer *temp = p;
-                p = p->next.load(std::memory_order_consume);
+                HazardRecordChunk *temp = p;
+                p = p->next.load(std::memory_order_acquire);
                 delete temp;
             }
         }
 
-        size_t get_size() const { return size.load(std::memory_order_consume); }
+        // Number of slots in records taken so far.
+        size_t get_size() const { return size.load(std::memory_order_acquire) * kHazardSlots; }
+
+        // Take an idle record, or append a new chunk if all are owned.
+        HazardRecord *Acquire() {
+            size_t index = 0;
+            HazardRecordChunk *chunk = head.load(std::memory_order_acquire);
+            while (true) {
+                for (auto &record: chunk->records) {
+                    if (!record.owned.test_and_set(std::memory_order_acquire)) {
+                        size_t old_size = size.load(std::memory_order_relaxed);
+                        while (old_size <= index &&
+                               !size.compare_exchange_weak(old_size, index + 1,
+                                                           std::memory_order_release,
+                                                           std::memory_order_relaxed)) {}
+                        return &record;
+                    }
+                    ++index;
+                }
+
+                HazardRecordChunk *next = chunk->next.load(std::memory_order_acquire);
+                if (next == nullptr) {
+                    auto *new_chunk = new HazardRecordChunk();
+                    if (chunk->next.compare_exchange_strong(next, new_chunk,
+                                                            std::memory_order_acq_rel)) {
+                        next = new_chunk;
+                    } else {
+                        delete new_chunk;
+                    }
+                }
+                chunk = next;
+            }
+        }
+
+        // Call fn(ptr) for every marked slot of the first size records.
+        template<typename F>
+        void ForEachHazard(F &&fn) const {
+            size_t remaining = size.load(std::memory_order_acquire);
+            HazardRecordChunk *chunk = head.load(std::memory_order_acquire);
+            while (chunk != nullptr && remaining > 0) {
+                size_t n = remaining < kHazardRecordsPerChunk ? remaining : kHazardRecordsPerChunk;
+                for (size_t i = 0; i < n; ++i) {
+                    for (auto &slot: chunk->records[i].slots) {
+                        void *const ptr = slot.load(std::memory_order_acquire);
+                        if (nullptr != ptr) fn(ptr);
+                    }
+                }
+                remaining -= n;
+                chunk = chunk->next.load(std::memory_order_acquire);
+            }
+        }
+
+        // Push nodes as one batch, O(1) for any number of nodes.
+        void PushOrphans(std::vector<ReclaimNode> &&nodes) {
+            auto *batch = new OrphanBatch{std::move(nodes), orphans.load(std::memory_order_relaxed)};
+            while (!orphans.compare_exchange_weak(batch->next, batch,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed)) {}
+        }
+
+        // Take all orphan batches at once, so the stack has no ABA problem.
+        OrphanBatch *TakeOrphans() {
+            if (orphans.load(std::memory_order_relaxed) == nullptr) return nullptr;
+            return orphans.exchange(nullptr, std::memory_order_acquire);
+        }
 
-        std::atomic<InternalHazardPointer *> head;
-        std::atomic<int> size;
+        std::atomic<HazardRecordChunk *> head;
+        std::atomic<size_t> size;  // Records ever taken.
+        std::atomic<OrphanBatch *> orphans;
     };
 
-}
\ No newline at end of file
+}
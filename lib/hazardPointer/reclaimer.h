@@ -8,11 +8,10 @@
 
 #include <atomic>
 #include <cassert>
-#include <functional>
-#include <thread>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
+#include "asymmetricFence.h"
+#include "backgroundReclaimer.h"
+#include "hazardSnapshot.h"
 #include "internalHazardPointer.h"
 
 namespace eht {
@@ -23,109 +22,97 @@ namespace eht {
         friend class HazardPointer;
 
     private:
-        // The max number of reclaim node in reclaim list.
+        // Reclaim list is scanned once it holds maxNodes pointers per hazard
+        // pointer more than were left over by the last scan.
         static const int maxNodes = 4;
         static const int HP_INDEX_NULL = -1;
 
     public:
+        // Frees a retired pointer, a plain function so that retiring costs
+        // no allocation.
+        using DeleteFunc = void (*)(void *);
+
         // delete copy and move constructors
         Reclaimer(const Reclaimer &) = delete;
         Reclaimer(Reclaimer &&) = delete;
         Reclaimer &operator=(const Reclaimer &) = delete;
         Reclaimer &operator=(Reclaimer &&) = delete;
 
-        // Mark ptr as hazard.
-        int MarkHazard(void *ptr);
+        /**
+         * Mark ptr as hazard, the index of its slot is taken from the idle
+         * slots of this thread. The mark must be visible before the caller
+         * re-reads where ptr was loaded from, which pairs with the heavy
+         * fence of scans, see HazardSnapshot::Take.
+         */
+        int MarkHazard(void *ptr) {
+            if (nullptr == ptr) return HP_INDEX_NULL;
+
+            if (free_slots_.empty()) AcquireRecord();
+            int index = free_slots_.back();
+            free_slots_.pop_back();
+            slots_[index]->store(ptr, std::memory_order_release);
+            AsymmetricFence::Light();
+            return index;
+        }
 
         void UnMarkHazard(int index) {
             if (index == HP_INDEX_NULL) return;
 
-            assert(index >= 0 && index < hp_list_.size());
-            hp_list_[index]->ptr.store(nullptr, std::memory_order_release);
+            assert(index >= 0 && static_cast<size_t>(index) < slots_.size());
+            slots_[index]->store(nullptr, std::memory_order_release);
+            free_slots_.push_back(index);
         }
 
-        // Get ptr that marked as hazard at the index of hazard_pointers_ array.
+        // Get ptr that marked as hazard at the index of slots_ array.
         void *GetHazardPtr(int index) {
             if (index == HP_INDEX_NULL) return nullptr;
 
-            assert(index >= 0 && index < hp_list_.size());
-            return hp_list_[index]->ptr.load(std::memory_order_relaxed);
+            assert(index >= 0 && static_cast<size_t>(index) < slots_.size());
+            return slots_[index]->load(std::memory_order_relaxed);
         }
 
         // If ptr is hazard then reclaim it later.
-        // put ptr into reclaim map.
-        void ReclaimLater(void *const ptr, std::function<void(void *)> &&func) {
-            ReclaimNode *new_node = reclaim_pool_.Pop();
-            new_node->ptr = ptr;
-            new_node->delete_func = std::move(func);
-            reclaim_map_.insert(std::make_pair(ptr, new_node));
+        // put ptr into reclaim list, a pointer must be retired only once.
+        void ReclaimLater(void *const ptr, DeleteFunc func) {
+            reclaim_list_.push_back({ptr, func});
         }
 
-        // Try to reclaim all no hazard pointers.
+        /**
+         * Try to reclaim all no hazard pointers. Hazard pointers are copied
+         * into a sorted snapshot, so the scan costs O(H log H + R log H) for
+         * H hazard pointers and R retired pointers, and it runs only after
+         * maxNodes * H new pointers were retired, at least (maxNodes - 1) * H
+         * of which are reclaimed. That makes it amortized O(log H) per
+         * retired pointer. With a BackgroundReclaimer the reclaim list is
+         * handed over instead, unless its queue is full.
+         */
         void ReclaimNoHazardPointer();
 
     protected:
-        explicit Reclaimer(HazardPointerList &hp_list);
+        // If background is not nullptr, scans run on its thread.
+        explicit Reclaimer(HazardPointerList &hp_list, BackgroundReclaimer *background = nullptr);
 
         ~Reclaimer();
 
     private:
-        // Check if the ptr is hazard.
-        bool Hazard(void *ptr);
+        // Move retired pointers of exited threads into reclaim_list_.
+        void AdoptOrphans();
 
         /**
-         * Try to acquire a new hazard pointer from global hazard pointer list.
-         * Or allocate a new hazard pointer.
-         * Push the new hazard pointer into hazard pointer list.
+         * Take a record from global hazard pointer list, which allocates a
+         * new one if all are owned. Its slots become idle slots of this
+         * thread. Most threads never need more than one.
          */
-        void TryAcquireHazardPointer();
-
-        struct ReclaimNode {
-            ReclaimNode() : ptr(nullptr), next(nullptr), delete_func(nullptr) {}
-
-            ~ReclaimNode() = default;
-
-            void *ptr;
-            ReclaimNode *next;
-            std::function<void(void *)> delete_func;
-        };
-
-        // Reuse ReclaimNode
-        // dll to store ReclaimNodes
-        struct ReclaimPool {
-            ReclaimPool() : head(new ReclaimNode()) {}
-
-            ~ReclaimPool() {
-                ReclaimNode *temp;
-                while (head) {
-                    temp = head;
-                    head = head->next;
-                    delete temp;
-                }
-            }
-
-            void Push(ReclaimNode *node) {
-                node->next = head;
-                head = node;
-            }
-
-            ReclaimNode *Pop() {
-                if (nullptr == head->next) {
-                    return new ReclaimNode();
-                }
-                ReclaimNode *temp = head;
-                head = head->next;
-                temp->next = nullptr;
-                return temp;
-            }
-
-            ReclaimNode *head;
-        };
-
-        std::vector<InternalHazardPointer *> hp_list_;
-        std::unordered_map<void *, ReclaimNode *> reclaim_map_;
-        ReclaimPool reclaim_pool_;
+        void AcquireRecord();
+
+        std::vector<HazardRecord *> records_;     // Records owned by this thread.
+        std::vector<std::atomic<void *> *> slots_;  // Slots of records_, by index.
+        std::vector<int> free_slots_;             // Indexes of idle slots.
+        std::vector<ReclaimNode> reclaim_list_;
+        HazardSnapshot hazard_snapshot_;  // Reused by every scan.
+        size_t hazard_kept_ = 0;  // Pointers left in reclaim_list_ by the last scan.
         HazardPointerList &global_hp_list_;
+        BackgroundReclaimer *background_;
     };
 
 #endif //LOCK_FREE_EHT_RECLAIMER_H
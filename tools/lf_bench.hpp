@@ -2,14 +2,19 @@
 // Created by Chaos Zhai on 12/14/23.
 //
 
+#include <algorithm>
+#include <cassert>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "../include/lockfree-eht.h"
+#include "../include/lockfree-unrolled-eht.h"
 
 using namespace eht;
 
@@ -178,10 +183,796 @@ void TestConcurrentInsertAndFindAndDequeue() {
     start = false;
 }
 
+// Every thread inserts and removes keys of a private range, so the table is
+// dominated by node allocation and reclamation.
+template<typename Alloc>
+int BenchNodeAllocator(int operations) {
+    LockFreeHashTable<int, int, std::hash<int>, Alloc> table;
+    const int kKeysPerThread = 1024;
+    std::vector<std::thread> threads;
+    threads.reserve(kMaxThreads);
+    auto t1_ = std::chrono::steady_clock::now();
+    for (int t = 0; t < kMaxThreads; ++t) {
+        threads.emplace_back([&table, operations, t] {
+            int n = operations / kMaxThreads;
+            for (int i = 0; i < n; ++i) {
+                int x = t * kKeysPerThread + i % kKeysPerThread;
+                table.Insert(x, x);
+                if (i % 2 == 1) table.Remove(x);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    auto t2_ = std::chrono::steady_clock::now();
+    return static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(t2_ - t1_).count());
+}
+
+// Compare per-thread slab pool with plain new/delete.
+void lf_alloc_bench() {
+    int operations[] = {100000, 1000000, 10000000};
+    for (int n : operations) {
+        int heap_ms = BenchNodeAllocator<HeapNodeAllocator>(n);
+        int pool_ms = BenchNodeAllocator<PooledNodeAllocator>(n);
+        std::cout << n << " insert & delete concurrently, new/delete timespan="
+                  << heap_ms << "ms, node pool timespan=" << pool_ms << "ms"
+                  << "\n";
+    }
+    std::cout << "\n";
+}
+
+// Look up random keys in batches of kBatch with MultiGet and with a loop of Get.
+void lf_multiget_bench() {
+    const int kBatch = 64;
+    const int kLookups = 4000000;
+    int elements[] = {100000, 1000000, 4000000};
+    for (int n : elements) {
+        LockFreeHashTable<int, int> table;
+        for (int i = 0; i < n; ++i) {
+            table.Insert(i, i);
+        }
+
+        std::mt19937 gen(n);
+        std::uniform_int_distribution<int> key_dist(0, 2 * n - 1);
+        std::vector<int> keys(kLookups);
+        for (auto &key : keys) {
+            key = key_dist(gen);
+        }
+        std::vector<int> values(kBatch);
+        bool found[kBatch];
+
+        // Warm up, buckets are initialized lazily by the first lookup.
+        for (int i = 0; i < 2 * n; ++i) {
+            table.Get(i, values[0]);
+        }
+
+        size_t get_found = 0;
+        auto t1_ = std::chrono::steady_clock::now();
+        for (int i = 0; i < kLookups; i += kBatch) {
+            for (int j = 0; j < kBatch; ++j) {
+                get_found += table.Get(keys[i + j], values[j]);
+            }
+        }
+        auto t2_ = std::chrono::steady_clock::now();
+        size_t multi_found = 0;
+        for (int i = 0; i < kLookups; i += kBatch) {
+            multi_found += table.MultiGet(&keys[i], kBatch, values.data(), found);
+        }
+        auto t3_ = std::chrono::steady_clock::now();
+        assert(get_found == multi_found);
+
+        auto get_us = std::chrono::duration_cast<std::chrono::microseconds>(t2_ - t1_).count();
+        auto multi_us = std::chrono::duration_cast<std::chrono::microseconds>(t3_ - t2_).count();
+        std::cout << n << " elements, " << kLookups << " lookups in batches of " << kBatch
+                  << ", Get timespan=" << get_us / 1000 << "ms, MultiGet timespan="
+                  << multi_us / 1000 << "ms, speedup="
+                  << static_cast<float>(get_us) / static_cast<float>(multi_us) << "\n";
+    }
+    std::cout << "\n";
+}
+
+void lf_bulk_load_bench() {
+    int elements[] = {100000, 1000000, 4000000};
+    for (int n : elements) {
+        std::vector<std::pair<int, int>> items(n);
+        for (int i = 0; i < n; ++i) {
+            items[i] = {i, i};
+        }
+        std::shuffle(items.begin(), items.end(), std::mt19937(n));
+
+        auto t1_ = std::chrono::steady_clock::now();
+        {
+            LockFreeHashTable<int, int> table;
+            for (auto &item : items) {
+                table.Insert(item.first, item.second);
+            }
+            assert(table.size() == static_cast<size_t>(n));
+        }
+        auto t2_ = std::chrono::steady_clock::now();
+        {
+            LockFreeHashTable<int, int> table(items);
+            assert(table.size() == static_cast<size_t>(n));
+        }
+        auto t3_ = std::chrono::steady_clock::now();
+
+        auto insert_us = std::chrono::duration_cast<std::chrono::microseconds>(t2_ - t1_).count();
+        auto bulk_us = std::chrono::duration_cast<std::chrono::microseconds>(t3_ - t2_).count();
+        std::cout << n << " elements, Insert timespan=" << insert_us / 1000
+                  << "ms, bulk load with " << DefaultThreads() << " threads timespan="
+                  << bulk_us / 1000 << "ms, speedup="
+                  << static_cast<float>(insert_us) / static_cast<float>(bulk_us) << "\n";
+    }
+    std::cout << "\n";
+}
+
+void lf_reserve_bench() {
+    int elements[] = {100000, 1000000, 4000000};
+    for (int n : elements) {
+        auto t1_ = std::chrono::steady_clock::now();
+        {
+            LockFreeHashTable<int, int> table;
+            for (int i = 0; i < n; ++i) {
+                table.Insert(i, i);
+            }
+        }
+        auto t2_ = std::chrono::steady_clock::now();
+        LockFreeHashTable<int, int> table(n);
+        auto t3_ = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            table.Insert(i, i);
+        }
+        auto t4_ = std::chrono::steady_clock::now();
+
+        auto lazy_us = std::chrono::duration_cast<std::chrono::microseconds>(t2_ - t1_).count();
+        auto reserve_us = std::chrono::duration_cast<std::chrono::microseconds>(t3_ - t2_).count();
+        auto warm_us = std::chrono::duration_cast<std::chrono::microseconds>(t4_ - t3_).count();
+        std::cout << n << " elements, Insert into empty table timespan=" << lazy_us / 1000
+                  << "ms, Reserve timespan=" << reserve_us / 1000
+                  << "ms, Insert into reserved table timespan=" << warm_us / 1000 << "ms\n";
+    }
+    std::cout << "\n";
+}
+
+// Every thread runs operations on keys of a shared table, read_percent of
+// them are Get and the rest alternate between Insert and Remove.
+template<typename Reclaim>
+int BenchReclamation(int read_percent, int operations) {
+    const int kKeys = 100000;
+    LockFreeHashTable<int, int, std::hash<int>, PooledNodeAllocator, Reclaim> table(kKeys);
+    for (int i = 0; i < kKeys; i += 2) {
+        table.Insert(i, i);
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(kMaxThreads);
+    auto t1_ = std::chrono::steady_clock::now();
+    for (int t = 0; t < kMaxThreads; ++t) {
+        threads.emplace_back([&table, read_percent, operations, t] {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<int> key_dist(0, kKeys - 1);
+            std::uniform_int_distribution<int> op_dist(0, 99);
+            int n = operations / kMaxThreads;
+            int value;
+            for (int i = 0; i < n; ++i) {
+                int x = key_dist(gen);
+                if (op_dist(gen) < read_percent) {
+                    table.Get(x, value);
+                } else if (i % 2 == 0) {
+                    table.Insert(x, x);
+                } else {
+                    table.Remove(x);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    auto t2_ = std::chrono::steady_clock::now();
+    return static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(t2_ - t1_).count());
+}
+
+// Compare hazard pointers with epoch based reclamation.
+void lf_reclaim_bench() {
+    const int kOperations = 10000000;
+    int read_percents[] = {95, 50};
+    for (int read_percent : read_percents) {
+        int hp_ms = BenchReclamation<HazardPointerReclamation>(read_percent, kOperations);
+        int epoch_ms = BenchReclamation<EpochReclamation>(read_percent, kOperations);
+        std::cout << kOperations << " operations with " << read_percent
+                  << "% reads concurrently, hazard pointer timespan=" << hp_ms
+                  << "ms, epoch timespan=" << epoch_ms << "ms"
+                  << "\n";
+    }
+    std::cout << "\n";
+}
+
+// Read values of value_size bytes with Get, which copies them out, and with
+// Visit, which reads them in place. Both sum up the first byte of values.
+void lf_visit_bench() {
+    const int kKeys = 10000;
+    const int kLookups = 4000000;
+    size_t value_sizes[] = {64, 1024, 4096};
+    for (size_t value_size : value_sizes) {
+        LockFreeHashTable<int, std::string> table;
+        for (int i = 0; i < kKeys; ++i) {
+            table.Insert(i, std::string(value_size, static_cast<char>('a' + i % 26)));
+        }
+        std::mt19937 gen(0);
+        std::uniform_int_distribution<int> key_dist(0, kKeys - 1);
+        std::vector<int> keys(kLookups);
+        for (auto &key : keys) key = key_dist(gen);
+
+        long get_sum = 0;
+        auto t1_ = std::chrono::steady_clock::now();
+        std::string value;
+        for (int key : keys) {
+            if (table.Get(key, value)) get_sum += value[0];
+        }
+        auto t2_ = std::chrono::steady_clock::now();
+        long visit_sum = 0;
+        for (int key : keys) {
+            table.Visit(key, [&visit_sum](const std::string &found) { visit_sum += found[0]; });
+        }
+        auto t3_ = std::chrono::steady_clock::now();
+        assert(get_sum == visit_sum);
+
+        auto get_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2_ - t1_).count();
+        auto visit_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t3_ - t2_).count();
+        std::cout << kLookups << " lookups of " << value_size << " byte values, Get timespan="
+                  << get_ms << "ms, Visit timespan=" << visit_ms << "ms\n";
+    }
+    std::cout << "\n";
+}
+
+// Look up random keys, half of them absent, in a table of a node per item
+// and in one of blocks of items, at growing load factors.
+void lf_unrolled_bench() {
+    const int kElements = 2000000;
+    const int kLookups = 4000000;
+    float load_factors[] = {0.5f, 2.0f, 4.0f, 8.0f};
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<int> key_dist(0, 2 * kElements - 1);
+    std::vector<int> keys(kLookups);
+    for (auto &key : keys) key = key_dist(gen);
+
+    for (float load_factor : load_factors) {
+        LockFreeHashTable<int, int> table(0, load_factor);
+        UnrolledLockFreeHashTable<int, int> unrolled(0, load_factor);
+        for (int i = 0; i < kElements; ++i) {
+            table.Insert(i, i);
+            unrolled.Insert(i, i);
+        }
+        // Warm up, buckets are initialized lazily by the first lookup.
+        int value;
+        for (int i = 0; i < 2 * kElements; ++i) {
+            table.Get(i, value);
+            unrolled.Get(i, value);
+        }
+
+        size_t table_found = 0;
+        auto t1_ = std::chrono::steady_clock::now();
+        for (int key : keys) table_found += table.Get(key, value);
+        auto t2_ = std::chrono::steady_clock::now();
+        size_t unrolled_found = 0;
+        for (int key : keys) unrolled_found += unrolled.Get(key, value);
+        auto t3_ = std::chrono::steady_clock::now();
+        assert(table_found == unrolled_found);
+
+        auto table_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2_ - t1_).count();
+        auto unrolled_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t3_ - t2_).count();
+        std::cout << kLookups << " lookups at load factor " << load_factor
+                  << ", node per item timespan=" << table_ms
+                  << "ms, unrolled timespan=" << unrolled_ms << "ms\n";
+    }
+    std::cout << "\n";
+}
+
 const int kElements1 = 10000;
 const int kElements2 = 100000;
 const int kElements3 = 1000000;
 
+// Remove most keys of a grown table while other threads look up the kept
+// keys, insert new ones and call Shrink, so buckets are unlinked under them.
+void TestConcurrentShrink() {
+    const int kKeys = 200000;
+    const int kKept = 16;  // Every kKept-th key is kept.
+    const int removers = std::max(kMaxThreads - 3, 1);
+    LockFreeHashTable<int, int> table;
+    for (int key = 0; key < kKeys; ++key) {
+        table.Insert(key, key);
+    }
+    size_t grown = table.bucket_count();
+
+    std::atomic<int> running = removers;
+    std::atomic<int> misses = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < removers; ++t) {
+        threads.emplace_back([&table, &running, t, removers]() {
+            for (int key = t; key < kKeys; key += removers) {
+                if (key % kKept != 0 && table.Remove(key)) {
+                    ++cnt;
+                }
+            }
+            --running;
+        });
+    }
+    threads.emplace_back([&table, &running, &misses]() {
+        while (running > 0) {
+            for (int key = 0; key < kKeys; key += kKept) {
+                int value = -1;
+                if (!table.Get(key, value) || value != key) {
+                    ++misses;
+                }
+            }
+        }
+    });
+    threads.emplace_back([&table]() {
+        for (int key = kKeys; key < kKeys + kKeys / kKept; ++key) {
+            table.Insert(key, key);
+        }
+    });
+    threads.emplace_back([&table, &running]() {
+        while (running > 0) {
+            table.Shrink();
+        }
+    });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    table.Shrink();
+
+    assert(misses == 0 && cnt == kKeys - kKeys / kKept);
+    size_t shrunk = table.bucket_count();
+    assert(shrunk < grown && table.size() == 2 * (kKeys / kKept));
+    int found = 0;
+    for (int key = 0; key < kKeys + kKeys / kKept; ++key) {
+        int value = -1;
+        bool kept = key >= kKeys || key % kKept == 0;
+        if (table.Get(key, value) == kept && (!kept || value == key)) {
+            ++found;
+        }
+    }
+    assert(found == kKeys + kKeys / kKept);
+    for (int key = 0; key < kKeys; ++key) {
+        table.Insert(key, key);
+    }
+    assert(table.size() == kKeys + kKeys / kKept);
+    std::cout << "shrink from " << grown << " to " << shrunk
+              << " buckets concurrently passed\n";
+    cnt = 0;
+}
+
+// Transparent, so tables of std::string keys are looked up by string_view.
+struct StringViewHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+};
+
+// Threads look up kept keys by string_view and with hashes computed up front,
+// while others remove the rest in the same ways. Every kept key must be found
+// and every removed key must be gone.
+void TestConcurrentTransparentLookup() {
+    const int kKeys = 20000;
+    const int removers = std::max(kMaxThreads / 2, 2);
+    LockFreeHashTable<std::string, int, StringViewHash> table;
+    std::vector<std::string> names;
+    std::vector<HashKey> hashes;
+    for (int key = 0; key < kKeys; ++key) {
+        names.push_back("key-" + std::to_string(key));
+        hashes.push_back(StringViewHash()(names.back()));
+        table.Insert(names.back(), key);
+    }
+
+    std::atomic<int> running = removers;
+    std::atomic<int> misses = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < removers; ++t) {
+        threads.emplace_back([&table, &names, &hashes, &running, t, removers]() {
+            for (int key = 2 * t + 1; key < kKeys; key += 2 * removers) {
+                std::string_view name = names[key];
+                bool removed = key % 3 == 0   ? table.Remove(name)
+                               : key % 3 == 1 ? table.Remove(name, hashes[key])
+                                              : table.Remove(names[key], hashes[key]);
+                if (removed) {
+                    ++cnt;
+                }
+            }
+            --running;
+        });
+        threads.emplace_back([&table, &names, &hashes, &running, &misses]() {
+            while (running > 0) {
+                for (int key = 0; key < kKeys; key += 2) {
+                    std::string_view name = names[key];
+                    int value = -1;
+                    if (key % 4 == 0) {
+                        table.Get(name, value);
+                    } else if (key % 8 == 2) {
+                        table.Get(names[key], hashes[key], value);
+                    } else {
+                        auto guard = table.Find(name, hashes[key]);
+                        value = guard ? *guard : -1;
+                    }
+                    if (value != key) {
+                        ++misses;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    assert(misses == 0 && cnt == kKeys / 2 && table.size() == kKeys / 2);
+    int found = 0;
+    for (int key = 0; key < kKeys; ++key) {
+        std::string_view name = names[key];
+        bool kept = key % 2 == 0;
+        int value = -1;
+        bool visited = table.Visit(name, [&value](const int &found_value) { value = found_value; });
+        if (visited == kept && table.Get(name, hashes[key], value) == kept &&
+            static_cast<bool>(table.Find(names[key], hashes[key])) == kept &&
+            (!kept || value == key)) {
+            ++found;
+        }
+    }
+    assert(found == kKeys);
+    std::cout << "transparent and pre-hashed lookups concurrently passed\n";
+    cnt = 0;
+}
+
+// Value of key written the version-th time, long enough to be heap allocated.
+std::string GuardedValue(int key, int version) {
+    return std::to_string(key) + ":" + std::string(40, static_cast<char>('a' + version % 26));
+}
+
+bool IsGuardedValue(int key, const std::string &value) {
+    std::string prefix = std::to_string(key) + ":";
+    if (value.size() != prefix.size() + 40 || value.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    return std::count(value.begin(), value.end(), value.back()) == 40;
+}
+
+// Readers hold values through ReadGuard and Visit while writers replace and
+// remove them. A value read must stay intact for as long as it is guarded.
+void TestConcurrentReadGuard() {
+    const int kKeys = 64;
+    const int kRounds = 5000;
+    const int readers = std::max(kMaxThreads / 2, 2);
+    LockFreeHashTable<int, std::string> table;
+    for (int key = 0; key < kKeys; ++key) {
+        table.Insert(key, GuardedValue(key, 0));
+    }
+
+    std::atomic<int> running = readers;
+    std::atomic<int> broken = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; ++t) {
+        threads.emplace_back([&table, &running, &broken, t]() {
+            for (int i = 0; i < kRounds; ++i) {
+                int key = (t + i) % kKeys;
+                if (i % 2 == 0) {
+                    auto guard = table.Find(key);
+                    if (!guard) continue;
+                    std::string copy = *guard;
+                    std::this_thread::yield();
+                    if (!IsGuardedValue(key, copy) || *guard != copy) {
+                        ++broken;
+                    }
+                } else {
+                    table.Visit(key, [&broken, key](const std::string &value) {
+                        std::string copy = value;
+                        std::this_thread::yield();
+                        if (!IsGuardedValue(key, copy) || value != copy) {
+                            ++broken;
+                        }
+                    });
+                }
+            }
+            --running;
+        });
+        threads.emplace_back([&table, &running, t]() {
+            for (int i = 1; running > 0; ++i) {
+                int key = (t + i) % kKeys;
+                if (i % 3 == 0) {
+                    table.Remove(key);
+                }
+                table.Insert(key, GuardedValue(key, i));
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    assert(broken == 0);
+    std::cout << "read guard and visit with concurrent writers passed\n";
+}
+
+// Threads insert batches holding every key twice, first with a stale value,
+// into a table holding a quarter of the keys already. Some keys are shared
+// by all threads. Every new key must count once and the last value of a
+// batch must win.
+void TestConcurrentMultiInsert() {
+    const int kKeys = 20000;  // Private keys of a thread.
+    const int kShared = 1000;
+    const int kBatchKeys = 32;
+    const int threads_num = std::max(kMaxThreads, 4);
+    const int all_keys = threads_num * kKeys + kShared;
+    LockFreeHashTable<int, int> table;
+    for (int key = 0; key < threads_num * kKeys; key += 4) {
+        table.Insert(key, -2);
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_num; ++t) {
+        threads.emplace_back([&table, t, threads_num]() {
+            std::vector<int> own;
+            for (int key = t * kKeys; key < (t + 1) * kKeys; ++key) {
+                own.push_back(key);
+            }
+            for (int i = 0; i < kShared; ++i) {
+                own.push_back(threads_num * kKeys + (i + t * 7) % kShared);
+            }
+            std::vector<int> keys;
+            std::vector<int> values;
+            for (size_t begin = 0; begin < own.size(); begin += kBatchKeys) {
+                size_t end = std::min(own.size(), begin + kBatchKeys);
+                keys.assign(own.begin() + begin, own.begin() + end);
+                values.assign(keys.size(), -1);
+                keys.insert(keys.end(), own.begin() + begin, own.begin() + end);
+                values.insert(values.end(), own.begin() + begin, own.begin() + end);
+                cnt += static_cast<int>(table.MultiInsert(keys.data(), values.data(), keys.size()));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    assert(cnt == all_keys - threads_num * kKeys / 4);
+    assert(table.size() == static_cast<size_t>(all_keys));
+    int found = 0;
+    for (int key = 0; key < all_keys; ++key) {
+        int value = -1;
+        if (table.Get(key, value) && value == key) {
+            ++found;
+        }
+    }
+    assert(found == all_keys);
+    std::cout << "multi insert of duplicate keys concurrently passed\n";
+    cnt = 0;
+}
+
+// Scan a table with Begin, in chunks with Scan and bucket by bucket with
+// ScanBucket while another thread inserts keys. Every key present for the
+// whole scan must be visited exactly once.
+void TestConcurrentCursor() {
+    using Cursor = LockFreeHashTable<int, int>::Cursor;
+    const int kKeys = 100000;
+    const int kInserts = 100000;
+    const int kChunks = 7;
+    LockFreeHashTable<int, int> table;
+    for (int key = 0; key < kKeys; ++key) {
+        table.Insert(key, key);
+    }
+
+    std::vector<int> visits(kKeys);
+    auto visit = [&visits](Cursor cursor) {
+        for (; cursor.Valid(); cursor.Next()) {
+            int key = cursor.key();
+            if (key < kKeys && cursor.value() == key) {
+                ++visits[key];
+            }
+        }
+    };
+    int next_key = kKeys;
+    for (int pass = 0; pass < 3; ++pass) {
+        if (pass == 2) {
+            // Bucket ranges change when the table grows.
+            table.Reserve(table.size() + kInserts);
+        }
+        std::atomic<bool> scanning = true;
+        std::thread inserter([&table, &scanning, &next_key]() {
+            for (int i = 0; i < kInserts && scanning; ++i, ++next_key) {
+                table.Insert(next_key, next_key);
+            }
+        });
+
+        if (pass == 0) {
+            visit(table.Begin());
+        } else if (pass == 1) {
+            HashKey chunk = ~0UL / kChunks;
+            for (int i = 0; i < kChunks; ++i) {
+                HashKey last = i == kChunks - 1 ? ~0UL : (i + 1) * chunk - 1;
+                visit(table.Scan(i * chunk, last));
+            }
+        } else {
+            size_t buckets = table.bucket_count();
+            for (size_t i = 0; i < buckets; ++i) {
+                visit(table.ScanBucket(i));
+            }
+        }
+        scanning = false;
+        inserter.join();
+
+        assert(std::count(visits.begin(), visits.end(), 1) == kKeys);
+        std::fill(visits.begin(), visits.end(), 0);
+    }
+    std::cout << "cursor scans with concurrent inserts passed\n";
+}
+
+// Not trivially copyable, so values are heap allocated, see value_slot.h.
+// live counts the instances not destroyed yet.
+struct BoxedCount {
+    BoxedCount(int64_t n_ = 0) : n(n_) { ++live; }
+    BoxedCount(const BoxedCount &other) : n(other.n) { ++live; }
+    ~BoxedCount() { --live; }
+    BoxedCount &operator=(const BoxedCount &other) = default;
+    operator int64_t() const { return n; }
+    int64_t n;
+    inline static std::atomic<int64_t> live = 0;
+};
+
+// Half of the threads add 1 to a few keys with Upsert, the others Extract
+// them meanwhile. Every increment is either extracted or still in the table.
+template<typename V>
+void TestConcurrentUpsertAndExtract(std::shared_ptr<typename LockFreeHashTable<int, V>::ReclaimDomain> domain =
+                                            std::make_shared<typename LockFreeHashTable<int, V>::ReclaimDomain>()) {
+    const int kKeys = 4;
+    const int kIncrements = 100000;
+    const int writers = std::max(kMaxThreads / 2, 2);
+    LockFreeHashTable<int, V> table(std::move(domain));
+    std::atomic<int> running = writers;
+    std::atomic<int64_t> extracted = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < writers; ++t) {
+        threads.emplace_back([&table, &running, t]() {
+            for (int i = 0; i < kIncrements; ++i) {
+                table.Upsert((t + i) % kKeys, V(1), [](const V &value) { return V(value + 1); });
+            }
+            --running;
+        });
+        threads.emplace_back([&table, &running, &extracted, t]() {
+            int64_t sum = 0;
+            for (int i = t; running > 0; ++i) {
+                std::optional<V> value = table.Extract(i % kKeys);
+                if (value.has_value()) {
+                    sum += *value;
+                }
+            }
+            extracted += sum;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    int64_t total = extracted;
+    for (int key = 0; key < kKeys; ++key) {
+        V value;
+        if (table.Get(key, value)) {
+            total += value;
+        }
+    }
+    assert(total == static_cast<int64_t>(writers) * kIncrements);
+    std::cout << "upsert & extract concurrently, " << total - extracted
+              << " increments left in table\n";
+}
+
+// Values replaced by Upsert and taken by Extract are retired to a domain
+// whose reclaimer thread frees them, and at most 2 batches wait for it, so
+// threads also scan themselves when it falls behind. Every value must be
+// freed once the domain is gone, including the batches still queued.
+void TestConcurrentBackgroundReclaim() {
+    [[maybe_unused]] int64_t live = BoxedCount::live;
+    {
+        auto domain = std::make_shared<LockFreeHashTable<int, BoxedCount>::ReclaimDomain>(2);
+        TestConcurrentUpsertAndExtract<BoxedCount>(domain);
+    }
+    assert(BoxedCount::live == live);
+    std::cout << "background reclaimer freed every retired value\n";
+}
+
+// Store buffering between two threads, one with AsymmetricFence::Light()
+// and one with Heavy() between its store and its load: at least one of
+// them must see the store of the other, as with two full fences. Then the
+// upsert & extract check runs on hazard pointers published the same way.
+// Without membarrier this checks the full fence fallback instead.
+void TestAsymmetricFence() {
+    const int kRounds = 20000;
+    std::atomic<int> x = 0;
+    std::atomic<int> y = 0;
+    std::atomic<int> go = 0;
+    std::atomic<int> arrived = 0;
+    int x_seen = 0;
+    int y_seen = 0;
+    auto run = [&](std::atomic<int> &mine, std::atomic<int> &other, int &seen, bool heavy) {
+        for (int round = 1; round <= kRounds; ++round) {
+            while (go.load(std::memory_order_acquire) != round) {
+                std::this_thread::yield();
+            }
+            mine.store(1, std::memory_order_relaxed);
+            if (heavy) {
+                AsymmetricFence::Heavy();
+            } else {
+                AsymmetricFence::Light();
+            }
+            seen = other.load(std::memory_order_relaxed);
+            arrived.fetch_add(1, std::memory_order_release);
+        }
+    };
+    std::thread light(run, std::ref(x), std::ref(y), std::ref(y_seen), false);
+    std::thread heavy(run, std::ref(y), std::ref(x), std::ref(x_seen), true);
+    int both_missed = 0;
+    for (int round = 1; round <= kRounds; ++round) {
+        x.store(0, std::memory_order_relaxed);
+        y.store(0, std::memory_order_relaxed);
+        go.store(round, std::memory_order_release);
+        while (arrived.load(std::memory_order_acquire) != 2 * round) {
+            std::this_thread::yield();
+        }
+        if (x_seen == 0 && y_seen == 0) {
+            ++both_missed;
+        }
+    }
+    light.join();
+    heavy.join();
+    assert(both_missed == 0);
+
+    TestConcurrentUpsertAndExtract<int>();
+    std::cout << "asymmetric fence with "
+              << (AsymmetricFence::Expedited() ? "membarrier" : "full fence fallback") << " passed\n";
+}
+
+// Threads insert interleaved keys into a table starting with 2 buckets, so
+// items are added to blocks while dummy nodes of new buckets split them and
+// are linked between them. Every key must be found afterwards.
+void TestConcurrentUnrolledInsert() {
+    const int kKeys = 200000;
+    const int threads_num = std::max(kMaxThreads, 4);
+    cnt = 0;
+    for (int round = 0; round < 10; ++round) {
+        UnrolledLockFreeHashTable<int, int> unrolled(0, 1.0f);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threads_num; ++t) {
+            threads.emplace_back([&unrolled, t, threads_num]() {
+                while (!start) {
+                    std::this_thread::yield();
+                }
+                for (int key = t; key < kKeys; key += threads_num) {
+                    if (unrolled.Insert(key, key)) {
+                        ++cnt;
+                    }
+                }
+            });
+        }
+
+        start = true;
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        start = false;
+
+        assert(cnt == kKeys && unrolled.size() == kKeys);
+        int found = 0;
+        for (int key = 0; key < kKeys; ++key) {
+            int value = -1;
+            if (unrolled.Get(key, value) && value == key) {
+                ++found;
+            }
+        }
+        assert(found == kKeys);
+        cnt = 0;
+    }
+    std::cout << "unrolled insert during bucket initialization passed\n\n";
+}
+
 int lf_bench() {
 
     srand(std::time(nullptr));
@@ -233,5 +1024,24 @@ int lf_bench() {
         std::cout << "\n";
     }
 
+    lf_alloc_bench();
+    lf_multiget_bench();
+    lf_bulk_load_bench();
+    lf_reserve_bench();
+    lf_reclaim_bench();
+    lf_visit_bench();
+    lf_unrolled_bench();
+    TestConcurrentUnrolledInsert();
+    TestConcurrentUpsertAndExtract<int>();
+    TestConcurrentUpsertAndExtract<int64_t>();
+    TestConcurrentUpsertAndExtract<BoxedCount>();
+    TestConcurrentBackgroundReclaim();
+    TestAsymmetricFence();
+    TestConcurrentShrink();
+    TestConcurrentCursor();
+    TestConcurrentMultiInsert();
+    TestConcurrentReadGuard();
+    TestConcurrentTransparentLookup();
+    std::cout << "\n";
     return 0;
 }